@@ -23,12 +23,32 @@ static const char help[] =
 "Options -snes_fd_color works well but is slower by a factor of two or so.\n"
 "\n"
 "Requires SNESVI (-snes_type vinewtonrsls|vinewtonssls) because of constraint,\n"
-"so, with current PETSc design, explicit TS types do not work.\n\n";
+"so, with current PETSc design, explicit TS types do not work.  Instead use\n"
+"-ice_explicit euler|ssp2, which takes explicit steps, projected onto H >= 0,\n"
+"outside of TS, for the whole run or until -ice_explicit_tf.\n\n";
 
 /* try:
 
 ./ice                                   # DEFAULT uses analytical jacobian
 ./ice -snes_fd_color
+./ice -ice_jac_assembly element         # element-major assembly; no work Vecs
+./ice -ice_verif 2 -ice_eps 0 -ice_fastpow_check   # check powers-by-multiplication
+./ice -ice_mask                         # skip elements away from ice
+
+# ensemble: one run per line (ela A maxslide) of params.txt, 2 at a time, results to ice_ensemble.csv
+mpiexec -n 4 ./ice -da_refine 3 -ice_tf 2000 -ice_monitor 0 -ice_ensemble params.txt -ice_ensemble_groups 2
+
+# explicit spin-up for 1000 years, then continue with ARKIMEX+VI
+./ice -da_refine 3 -ice_tf 5000 -ice_explicit ssp2 -ice_explicit_tf 1000
+
+# write H every 10 steps without stalling the time stepping
+mpiexec -n 4 ./ice -da_refine 5 -ice_tf 5000 -ice_snapshot_every 10 -ice_snapshot run1
+# ... and start a new run from one of them
+./ice -da_refine 5 -ice_tf 1000 -ice_initial run1_100.dat
+
+# checkpoint every 100 steps, then (e.g. after walltime ran out) restart
+mpiexec -n 4 ./ice -da_refine 6 -ice_tf 50000 -ice_checkpoint_every 100
+mpiexec -n 8 ./ice -da_refine 6 -ice_tf 50000 -ice_checkpoint_every 100 -ice_restart ice_checkpoint.dat
 
 ./ice -ts_view
 ./ice -da_refine 3                      # only meaningful at this res and higher
@@ -100,6 +120,22 @@ mpiexec -n 4 ./ice -da_refine 6 -pc_type mg -pc_mg_levels 4 -ice_dtlimits -ice_t
 #include <petsc.h>
 #include "icecmb.h"
 
+// state of the nonblocking snapshot writer; see SnapshotMonitor()
+typedef struct {
+    MPI_File    fh;
+    MPI_Request req;
+    double      *buf;    // staging copy of owned part of H, in file byte order
+    PetscBool   pending; // true if a write was started but not completed
+} SnapshotWriter;
+
+typedef enum {NODE, ELEMENT} JacAssemblyType;
+static const char* JacAssemblyTypes[] = {"node","element",
+                                         "JacAssemblyType", "", NULL};
+
+typedef enum {EXPLICIT_NONE, EXPLICIT_EULER, EXPLICIT_SSP2} ExplicitType;
+static const char* ExplicitTypes[] = {"none","euler","ssp2",
+                                      "ExplicitType", "", NULL};
+
 // context is entirely grid-independent info
 typedef struct {
     double    secpera,// number of seconds in a year
@@ -118,11 +154,34 @@ typedef struct {
               maxslide,// maximum sliding speed in bed-slope-based model
               locmaxD,// maximum of diffusivity from last residual evaluation
               locmaxV,// maximum absolute velocity component from last residual eval
-              dtexplicitsum;// running sum of explicit dt limit
-    int       verif;  // 0 = not verification, 1 = dome, 2 = Halfar (1983)
+              dtexplicitsum,// running sum of explicit dt limit
+              explicittf,// end of explicit phase (if > 0; otherwise tf)
+              explicitcfl,// fraction of explicit time-step limit actually used
+              checkpointdt,// model time between checkpoints (if > 0)
+              nextcheckpoint;// model time of next checkpoint if checkpointdt > 0
+    int       verif,  // 0 = not verification, 1 = dome, 2 = Halfar (1983)
+              nint,   // = n_ice if integer and -ice_fastpow; otherwise 0
+              checkpointevery,// steps between checkpoints (if > 0)
+              restartstep,// step read by ReadCheckpoint() (otherwise -1)
+              snapshotevery,// steps between snapshots of H (if > 0)
+              ensemblegroups;// number of sub-communicators running ensemble members
+    JacAssemblyType jacassembly;// node-major (default) or element-major Jacobian
+    ExplicitType explicitscheme;// if not none, explicit steps before (or instead of) TSSolve()
     PetscBool monitor,// use -ice_monitor
               dtlimits,// also monitor time step limits for explicit schemes
-              dump;   // dump state (H,b) at final time
+              dump,   // dump state (H,b) at final time
+              mask,   // skip elements away from ice; see IceMaskPreStep()
+              fastpow,// use multiplications for powers if n is an integer
+              fastpowcheck,// compare fast and PetscPowReal() powers at final time
+              ensemblewarm;// start each ensemble member from the previous final H
+    char      checkpointname[PETSC_MAX_PATH_LEN],// file for checkpoints
+              restartname[PETSC_MAX_PATH_LEN],// file to restart from (if not empty)
+              initialname[PETSC_MAX_PATH_LEN],// file to read initial H from (if not empty)
+              snapshotroot[PETSC_MAX_PATH_LEN],// snapshot file names start with this
+              ensemblename[PETSC_MAX_PATH_LEN],// ensemble parameter table (if not empty)
+              ensemblecsv[PETSC_MAX_PATH_LEN],// ensemble results file
+              label[32];// prefix of monitor lines; "[member m] " in an ensemble
+    SnapshotWriter snap;
     CMBModel  *cmb;// defined in cmbmodel.h
 } AppCtx;
 
@@ -131,12 +190,26 @@ typedef struct {
 extern PetscErrorCode SetFromOptionsAppCtx(AppCtx*);
 extern PetscErrorCode IceMonitor(TS, int, double, Vec, void*);
 extern PetscErrorCode ExplicitLimitsMonitor(TS, int, double, Vec, void*);
+extern PetscErrorCode CheckpointMonitor(TS, int, double, Vec, void*);
+extern PetscErrorCode ReadCheckpoint(TS, Vec, AppCtx*);
+extern PetscErrorCode SnapshotMonitor(TS, int, double, Vec, void*);
+extern PetscErrorCode SnapshotFinish(AppCtx*);
+extern PetscErrorCode FastPowCheck(TS, Vec, AppCtx*);
+extern PetscErrorCode ExplicitSolve(TS, Vec, double, AppCtx*);
+extern PetscErrorCode FormInitialH(TS, Vec, AppCtx*);
+extern PetscErrorCode IceSolve(TS, Vec, AppCtx*);
+extern PetscErrorCode IceVolumeArea(DM, Vec, AppCtx*, double*, double*);
+extern PetscErrorCode VerifErrors(TS, Vec, AppCtx*, double*, double*);
+extern PetscErrorCode EnsembleSolve(TS, Vec, AppCtx*);
 extern PetscErrorCode FormBedLocal(DMDALocalInfo*, int, double**, AppCtx*);
 extern PetscErrorCode FormBounds(SNES,Vec,Vec);
+extern PetscErrorCode IceMaskPreStep(TS);
 extern PetscErrorCode FormIFunctionLocal(DMDALocalInfo*, double,
                           double**, double**, double**, AppCtx*);
 extern PetscErrorCode FormIJacobianLocal(DMDALocalInfo*, double,
                           double**, double**, double, Mat, Mat, AppCtx *user);
+extern PetscErrorCode FormIJacobianElementLocal(DMDALocalInfo*, double,
+                          double**, double**, double, Mat, Mat, AppCtx *user);
 extern PetscErrorCode FormRHSFunctionLocal(DMDALocalInfo*, double,
                           double**, double**, AppCtx*);
 
@@ -150,7 +223,8 @@ int main(int argc,char **argv) {
   AppCtx         user;
   CMBModel       cmb;
   DMDALocalInfo  info;
-  double         dx,dy,**aH;
+  MPI_Comm       comm = PETSC_COMM_WORLD;
+  double         dx,dy;
 
   PetscInitialize(&argc,&argv,(char*)0,help);
 
@@ -158,8 +232,21 @@ int main(int argc,char **argv) {
   ierr = SetFromOptions_CMBModel(&cmb,"ice_cmb_",user.secpera);
   user.cmb = &cmb;
 
+  // in an ensemble, each group of processes solves on its own grid
+  if (strlen(user.ensemblename) > 0 && user.ensemblegroups > 1) {
+      PetscMPIInt rank, size;
+      ierr = MPI_Comm_rank(PETSC_COMM_WORLD,&rank); CHKERRQ(ierr);
+      ierr = MPI_Comm_size(PETSC_COMM_WORLD,&size); CHKERRQ(ierr);
+      if (user.ensemblegroups > size) {
+          SETERRQ2(PETSC_COMM_WORLD,8,"-ice_ensemble_groups %d exceeds number of processes %d\n",
+                   user.ensemblegroups,size);
+      }
+      ierr = MPI_Comm_split(PETSC_COMM_WORLD,(rank * user.ensemblegroups) / size,
+                            rank,&comm); CHKERRQ(ierr);
+  }
+
   // this DMDA is the cell-centered grid
-  ierr = DMDACreate2d(PETSC_COMM_WORLD,
+  ierr = DMDACreate2d(comm,
                       DM_BOUNDARY_PERIODIC,DM_BOUNDARY_PERIODIC,
                       DMDA_STENCIL_BOX,
                       3,3,PETSC_DECIDE,PETSC_DECIDE,
@@ -184,7 +271,7 @@ int main(int argc,char **argv) {
   ierr = PetscObjectSetName((PetscObject)H,"H"); CHKERRQ(ierr);
 
   // initialize the TS
-  ierr = TSCreate(PETSC_COMM_WORLD,&ts); CHKERRQ(ierr);
+  ierr = TSCreate(comm,&ts); CHKERRQ(ierr);
   ierr = TSSetProblemType(ts,TS_NONLINEAR); CHKERRQ(ierr);
   ierr = TSSetType(ts,TSARKIMEX); CHKERRQ(ierr);
   ierr = TSGetAdapt(ts,&adapt); CHKERRQ(ierr);
@@ -193,8 +280,13 @@ int main(int argc,char **argv) {
   ierr = TSSetDM(ts,da); CHKERRQ(ierr);
   ierr = DMDATSSetIFunctionLocal(da,INSERT_VALUES,
            (DMDATSIFunctionLocal)FormIFunctionLocal,&user); CHKERRQ(ierr);
-  ierr = DMDATSSetIJacobianLocal(da,
-           (DMDATSIJacobianLocal)FormIJacobianLocal,&user); CHKERRQ(ierr);
+  if (user.jacassembly == ELEMENT) {
+      ierr = DMDATSSetIJacobianLocal(da,
+               (DMDATSIJacobianLocal)FormIJacobianElementLocal,&user); CHKERRQ(ierr);
+  } else {
+      ierr = DMDATSSetIJacobianLocal(da,
+               (DMDATSIJacobianLocal)FormIJacobianLocal,&user); CHKERRQ(ierr);
+  }
   ierr = DMDATSSetRHSFunctionLocal(da,INSERT_VALUES,
            (DMDATSRHSFunctionLocal)FormRHSFunctionLocal,&user); CHKERRQ(ierr);
   if (user.monitor) {
@@ -203,6 +295,15 @@ int main(int argc,char **argv) {
   if (user.dtlimits) {
       ierr = TSMonitorSet(ts,ExplicitLimitsMonitor,&user,NULL); CHKERRQ(ierr);
   }
+  if (user.mask) {
+      ierr = TSSetPreStep(ts,IceMaskPreStep); CHKERRQ(ierr);
+  }
+  if (user.checkpointevery > 0 || user.checkpointdt > 0.0) {
+      ierr = TSMonitorSet(ts,CheckpointMonitor,&user,NULL); CHKERRQ(ierr);
+  }
+  if (user.snapshotevery > 0) {
+      ierr = TSMonitorSet(ts,SnapshotMonitor,&user,NULL); CHKERRQ(ierr);
+  }
 
   // configure the SNES to solve NCP/VI at each step
   ierr = TSGetSNES(ts,&snes); CHKERRQ(ierr);
@@ -216,23 +317,26 @@ int main(int argc,char **argv) {
   ierr = TSSetExactFinalTime(ts,TS_EXACTFINALTIME_MATCHSTEP); CHKERRQ(ierr);
   ierr = TSSetFromOptions(ts);CHKERRQ(ierr);
 
+  // many runs with the same grid and solver, then done
+  if (strlen(user.ensemblename) > 0) {
+      ierr = EnsembleSolve(ts,H,&user); CHKERRQ(ierr);
+      VecDestroy(&H);  TSDestroy(&ts);  DMDestroy(&da);
+      if (comm != PETSC_COMM_WORLD) {
+          ierr = MPI_Comm_free(&comm); CHKERRQ(ierr);
+      }
+      return PetscFinalize();
+  }
+
   // set up initial condition on fine grid
-  ierr = DMDAVecGetArray(da,H,&aH); CHKERRQ(ierr);
-  if (user.verif == 1) {
-      ierr = DomeThicknessLocal(&info,aH,&user); CHKERRQ(ierr);
-  } else if (user.verif == 2) {
-      double t0;
-      ierr = TSGetTime(ts,&t0); CHKERRQ(ierr);
-      ierr = HalfarThicknessLocal(&info,t0,aH,&user); CHKERRQ(ierr);
-  } else {
-      // fill H according to chop-scale-CMB
-      ierr = FormBedLocal(&info,0,aH,&user); CHKERRQ(ierr);  // H(x,y) <- b(x,y)
-      ierr = ChopScaleInitialHLocal_CMBModel(&cmb,&info,aH,aH); CHKERRQ(ierr);
+  ierr = FormInitialH(ts,H,&user); CHKERRQ(ierr);
+
+  // overwrite H, and time-stepping state, if restarting
+  if (strlen(user.restartname) > 0) {
+      ierr = ReadCheckpoint(ts,H,&user); CHKERRQ(ierr);
   }
-  ierr = DMDAVecRestoreArray(da,H,&aH); CHKERRQ(ierr);
 
   // solve
-  ierr = TSSolve(ts,H); CHKERRQ(ierr);
+  ierr = IceSolve(ts,H,&user); CHKERRQ(ierr);
 
   // time-stepping summary if -ice_dtlimits
   if (user.dtlimits) {
@@ -264,29 +368,17 @@ int main(int argc,char **argv) {
       VecDestroy(&b);
   }
 
+  if (user.fastpowcheck) {
+      ierr = FastPowCheck(ts,H,&user); CHKERRQ(ierr);
+  }
+
   // compute error in verification case
   if (user.verif > 0) {
-      Vec Hexact;
-      double infnorm, onenorm;
-      ierr = VecDuplicate(H,&Hexact); CHKERRQ(ierr);
-      ierr = DMDAVecGetArray(da,Hexact,&aH); CHKERRQ(ierr);
-      if (user.verif == 1) {
-          ierr = DomeThicknessLocal(&info,aH,&user); CHKERRQ(ierr);
-      } else if (user.verif == 2) {
-          double tf;
-          ierr = TSGetTime(ts,&tf); CHKERRQ(ierr);
-          ierr = HalfarThicknessLocal(&info,tf,aH,&user); CHKERRQ(ierr);
-      } else {
-          SETERRQ(PETSC_COMM_WORLD,3,"invalid user.verif ... how did I get here?\n");
-      }
-      ierr = DMDAVecRestoreArray(da,Hexact,&aH); CHKERRQ(ierr);
-      ierr = VecAXPY(H,-1.0,Hexact); CHKERRQ(ierr);    // H <- H + (-1.0) Hexact
-      VecDestroy(&Hexact);
-      ierr = VecNorm(H,NORM_INFINITY,&infnorm); CHKERRQ(ierr);
-      ierr = VecNorm(H,NORM_1,&onenorm); CHKERRQ(ierr);
+      double infnorm, avnorm;
+      ierr = VerifErrors(ts,H,&user,&infnorm,&avnorm); CHKERRQ(ierr);
       ierr = PetscPrintf(PETSC_COMM_WORLD,
           "errors on verif %d: |H-Hexact|_inf = %.3f, |H-Hexact|_average = %.3f\n",
-          user.verif,infnorm,onenorm/(double)(info.mx*info.my)); CHKERRQ(ierr);
+          user.verif,infnorm,avnorm); CHKERRQ(ierr);
   }
 
   // clean up
@@ -313,10 +405,33 @@ PetscErrorCode SetFromOptionsAppCtx(AppCtx *user) {
   user->lambda = 0.25;
   user->maxslide = 200.0 / user->secpera; // m/s; only used on non-flat beds
   user->dtexplicitsum = 0.0;
+  user->explicittf = 0.0;
+  user->explicitcfl = 0.9;
+  user->checkpointdt = 0.0;
+  user->nextcheckpoint = 0.0;
+  user->checkpointevery = 0;
+  user->restartstep = -1;
+  user->snapshotevery = 0;
+  strcpy(user->snapshotroot,"ice_snapshot");
+  user->ensemblegroups = 1;
+  strcpy(user->ensemblename,"");
+  strcpy(user->ensemblecsv,"ice_ensemble.csv");
+  user->ensemblewarm = PETSC_FALSE;
+  strcpy(user->label,"");
+  user->snap.buf = NULL;
+  user->snap.pending = PETSC_FALSE;
+  strcpy(user->checkpointname,"ice_checkpoint.dat");
+  strcpy(user->restartname,"");
+  strcpy(user->initialname,"");
   user->verif  = 0;
+  user->jacassembly = NODE;
+  user->explicitscheme = EXPLICIT_NONE;
   user->monitor = PETSC_TRUE;
   user->dtlimits = PETSC_FALSE;
   user->dump   = PETSC_FALSE;
+  user->mask   = PETSC_FALSE;
+  user->fastpow = PETSC_TRUE;
+  user->fastpowcheck = PETSC_FALSE;
   user->cmb    = NULL;
 
   PetscFunctionBeginUser;
@@ -324,6 +439,17 @@ PetscErrorCode SetFromOptionsAppCtx(AppCtx *user) {
   ierr = PetscOptionsReal(
       "-A", "set value of ice softness A in units Pa-3 s-1",
       "ice.c",user->A_ice,&user->A_ice,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsString(
+      "-checkpoint", "name of PETSc binary file for checkpoints",
+      "ice.c",user->checkpointname,user->checkpointname,
+      sizeof(user->checkpointname),NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsInt(
+      "-checkpoint_every", "write checkpoint every N time steps",
+      "ice.c",user->checkpointevery,&user->checkpointevery,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsReal(
+      "-checkpoint_years", "write checkpoint every T model years",
+      "ice.c",user->checkpointdt,&user->checkpointdt,&set);CHKERRQ(ierr);
+  if (set)   user->checkpointdt *= user->secpera;
   ierr = PetscOptionsReal(
       "-D0", "representative value of diffusivity (used in regularizing D) in units m2 s-1",
       "ice.c",user->D0,&user->D0,NULL);CHKERRQ(ierr);
@@ -340,15 +466,56 @@ PetscErrorCode SetFromOptionsAppCtx(AppCtx *user) {
   ierr = PetscOptionsBool(
       "-dump", "save final state (H, b)",
       "ice.c",user->dump,&user->dump,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsString(
+      "-ensemble", "run each line (ela A maxslide) of this table as an ensemble member",
+      "ice.c",user->ensemblename,user->ensemblename,
+      sizeof(user->ensemblename),NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsString(
+      "-ensemble_csv", "file for one line of results per ensemble member",
+      "ice.c",user->ensemblecsv,user->ensemblecsv,
+      sizeof(user->ensemblecsv),NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsInt(
+      "-ensemble_groups", "split processes into this many groups, each running ensemble members",
+      "ice.c",user->ensemblegroups,&user->ensemblegroups,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsBool(
+      "-ensemble_warm", "start each ensemble member from the final H of the previous member",
+      "ice.c",user->ensemblewarm,&user->ensemblewarm,NULL);CHKERRQ(ierr);
   ierr = PetscOptionsReal(
       "-eps", "dimensionless regularization for diffusivity D",
       "ice.c",user->eps,&user->eps,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsEnum(
+      "-explicit", "explicit scheme (no Jacobian, no VI solve) for the first -ice_explicit_tf years, or whole run",
+      "ice.c",ExplicitTypes,(PetscEnum)(user->explicitscheme),(PetscEnum*)&(user->explicitscheme),
+      NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsReal(
+      "-explicit_cfl", "explicit steps are this fraction of min(dtD,dtCFL)",
+      "ice.c",user->explicitcfl,&user->explicitcfl,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsReal(
+      "-explicit_tf", "end time of explicit phase, after which TS continues; input units are years",
+      "ice.c",user->explicittf,&user->explicittf,&set);CHKERRQ(ierr);
+  if (set)   user->explicittf *= user->secpera;
+  ierr = PetscOptionsBool(
+      "-fastpow", "if n is an integer then compute powers in SIA formulas by multiplication",
+      "ice.c",user->fastpow,&user->fastpow,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsBool(
+      "-fastpow_check", "at final time, compare residual and Jacobian from -ice_fastpow against PetscPowReal() versions",
+      "ice.c",user->fastpowcheck,&user->fastpowcheck,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsString(
+      "-initial", "read initial H from this PETSc binary file, e.g. a snapshot (see -ice_snapshot_every)",
+      "ice.c",user->initialname,user->initialname,
+      sizeof(user->initialname),NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsEnum(
+      "-jac_assembly", "Jacobian assembly order: node = one row per node, element = 4x4 block per element",
+      "ice.c",JacAssemblyTypes,(PetscEnum)user->jacassembly,(PetscEnum*)&user->jacassembly,NULL);CHKERRQ(ierr);
   ierr = PetscOptionsReal(
       "-L", "side length of domain in meters",
       "ice.c",user->L,&user->L,NULL);CHKERRQ(ierr);
   ierr = PetscOptionsReal(
       "-lambda", "amount of upwinding; lambda=0 is none and lambda=1 is full",
       "ice.c",user->lambda,&user->lambda,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsBool(
+      "-mask", "skip residual and Jacobian evaluation on elements away from the ice",
+      "ice.c",user->mask,&user->mask,NULL);CHKERRQ(ierr);
   ierr = PetscOptionsReal(
       "-maxslide", "maximum sliding speed in bed-slope-based model; input units are m/a",
       "ice.c",user->maxslide,&user->maxslide,&set);CHKERRQ(ierr);
@@ -364,9 +531,20 @@ PetscErrorCode SetFromOptionsAppCtx(AppCtx *user) {
       SETERRQ1(PETSC_COMM_WORLD,1,
           "ERROR: n = %f not allowed ... n > 1 is required\n",user->n_ice);
   }
+  ierr = PetscOptionsString(
+      "-restart", "restart from this checkpoint file (see -ice_checkpoint_every)",
+      "ice.c",user->restartname,user->restartname,
+      sizeof(user->restartname),NULL);CHKERRQ(ierr);
   ierr = PetscOptionsReal(
       "-rho", "ice density in units kg m3",
       "ice.c",user->rho_ice,&user->rho_ice,NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsString(
+      "-snapshot", "root of names of snapshot files; step number and .dat are appended",
+      "ice.c",user->snapshotroot,user->snapshotroot,
+      sizeof(user->snapshotroot),NULL);CHKERRQ(ierr);
+  ierr = PetscOptionsInt(
+      "-snapshot_every", "write H to a PETSc binary file every N time steps, without blocking",
+      "ice.c",user->snapshotevery,&user->snapshotevery,NULL);CHKERRQ(ierr);
   ierr = PetscOptionsReal(
       "-tf", "final time in seconds; input units are years",
       "ice.c",user->tf,&user->tf,&set);CHKERRQ(ierr);
@@ -384,42 +562,304 @@ PetscErrorCode SetFromOptionsAppCtx(AppCtx *user) {
   // derived constant computed after other ice properties are set
   user->Gamma = 2.0 * PetscPowReal(user->rho_ice*user->g,user->n_ice) 
                     * user->A_ice / (user->n_ice+2.0);
+  user->nint = 0;
+  if (user->fastpow && user->n_ice == PetscFloorReal(user->n_ice))
+      user->nint = (int)(user->n_ice);
+  user->nextcheckpoint = user->checkpointdt;
 
   PetscFunctionReturn(0);
 }
 
 
-// this basic monitor gives current time, volume, area
-PetscErrorCode IceMonitor(TS ts, int step, double time, Vec H, void *ctx) {
+// fill H with the initial condition for the current TS time, or read it
+// from the -ice_initial file
+PetscErrorCode FormInitialH(TS ts, Vec H, AppCtx *user) {
+  PetscErrorCode ierr;
+  DM             da;
+  DMDALocalInfo  info;
+  double         **aH;
+
+  PetscFunctionBeginUser;
+  ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+  if (strlen(user->initialname) > 0) {
+      MPI_Comm    com;
+      PetscViewer viewer;
+      ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+      ierr = PetscPrintf(com,"reading initial H from %s ...\n",user->initialname); CHKERRQ(ierr);
+      ierr = PetscViewerBinaryOpen(com,user->initialname,FILE_MODE_READ,&viewer); CHKERRQ(ierr);
+      ierr = VecLoad(H,viewer); CHKERRQ(ierr);
+      ierr = PetscViewerDestroy(&viewer); CHKERRQ(ierr);
+      PetscFunctionReturn(0);
+  }
+  ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+  ierr = DMDAVecGetArray(da,H,&aH); CHKERRQ(ierr);
+  if (user->verif == 1) {
+      ierr = DomeThicknessLocal(&info,aH,user); CHKERRQ(ierr);
+  } else if (user->verif == 2) {
+      double t0;
+      ierr = TSGetTime(ts,&t0); CHKERRQ(ierr);
+      ierr = HalfarThicknessLocal(&info,t0,aH,user); CHKERRQ(ierr);
+  } else {
+      // fill H according to chop-scale-CMB
+      ierr = FormBedLocal(&info,0,aH,user); CHKERRQ(ierr);  // H(x,y) <- b(x,y)
+      ierr = ChopScaleInitialHLocal_CMBModel(user->cmb,&info,aH,aH); CHKERRQ(ierr);
+  }
+  ierr = DMDAVecRestoreArray(da,H,&aH); CHKERRQ(ierr);
+  PetscFunctionReturn(0);
+}
+
+// from the current TS time to tf:  optional explicit phase (e.g. spin-up),
+// then TSSolve()
+PetscErrorCode IceSolve(TS ts, Vec H, AppCtx *user) {
+  PetscErrorCode ierr;
+  double         t0, te;
+
+  PetscFunctionBeginUser;
+  if (user->explicitscheme != EXPLICIT_NONE) {
+      ierr = TSGetTime(ts,&t0); CHKERRQ(ierr);
+      te = (user->explicittf > 0.0) ? PetscMin(user->explicittf,user->tf) : user->tf;
+      if (te > t0) {
+          ierr = ExplicitSolve(ts,H,te,user); CHKERRQ(ierr);
+      }
+  }
+  ierr = TSGetTime(ts,&t0); CHKERRQ(ierr);
+  if (t0 < user->tf) {
+      ierr = TSSolve(ts,H); CHKERRQ(ierr);
+  }
+  ierr = SnapshotFinish(user); CHKERRQ(ierr);
+  PetscFunctionReturn(0);
+}
+
+// in verification cases, compute |H-Hexact|_inf and |H-Hexact|_1 / (mx my)
+// at the current TS time; H is not modified
+PetscErrorCode VerifErrors(TS ts, Vec H, AppCtx *user, double *infnorm, double *avnorm) {
+  PetscErrorCode ierr;
+  DM             da;
+  DMDALocalInfo  info;
+  Vec            Hexact;
+  double         **aH, onenorm;
+
+  PetscFunctionBeginUser;
+  ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+  ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+  ierr = VecDuplicate(H,&Hexact); CHKERRQ(ierr);
+  ierr = DMDAVecGetArray(da,Hexact,&aH); CHKERRQ(ierr);
+  if (user->verif == 1) {
+      ierr = DomeThicknessLocal(&info,aH,user); CHKERRQ(ierr);
+  } else if (user->verif == 2) {
+      double tf;
+      ierr = TSGetTime(ts,&tf); CHKERRQ(ierr);
+      ierr = HalfarThicknessLocal(&info,tf,aH,user); CHKERRQ(ierr);
+  } else {
+      SETERRQ(PETSC_COMM_WORLD,3,"invalid user.verif ... how did I get here?\n");
+  }
+  ierr = DMDAVecRestoreArray(da,Hexact,&aH); CHKERRQ(ierr);
+  ierr = VecAYPX(Hexact,-1.0,H); CHKERRQ(ierr);    // Hexact <- H + (-1.0) Hexact
+  ierr = VecNorm(Hexact,NORM_INFINITY,infnorm); CHKERRQ(ierr);
+  ierr = VecNorm(Hexact,NORM_1,&onenorm); CHKERRQ(ierr);
+  *avnorm = onenorm / (double)(info.mx*info.my);
+  VecDestroy(&Hexact);
+  PetscFunctionReturn(0);
+}
+
+/* Ensemble mode (-ice_ensemble FILE).  Each line of FILE which starts with
+three numbers
+    ela A maxslide
+(units m, Pa-3 s-1, m/a; separated by spaces or commas) is a member.  Other
+lines, e.g. a header or "#" comments, are skipped.  Members are run one after
+another on the same DMDA, TS and SNES, so grid setup, the bed cache, and
+solver setup (including Jacobian preallocation) are paid once.  With
+-ice_ensemble_groups G the processes are split into G groups in main(), and
+member m runs on group m mod G.  One line of results per member is written
+by rank 0 to -ice_ensemble_csv.  Monitor output comes from every group, with
+lines starting "[member m]", and checkpoint and snapshot file names get
+"_member<m>" before any extension, so that groups do not overwrite each
+other's files.  */
+
+// name is base with "_member<m>" inserted before the extension, if any
+static PetscErrorCode MemberFileName(const char *base, int m, char *name, size_t len) {
+  PetscErrorCode ierr;
+  const char     *dot = strrchr(base,'.'), *slash = strrchr(base,'/');
+  int            n;
+
+  PetscFunctionBeginUser;
+  if (!dot || (slash && dot < slash))
+      dot = base + strlen(base);
+  n = (int)(dot - base);
+  ierr = PetscSNPrintf(name,len,"%.*s_member%d%s",n,base,m,dot); CHKERRQ(ierr);
+  PetscFunctionReturn(0);
+}
+
+PetscErrorCode EnsembleSolve(TS ts, Vec H, AppCtx *user) {
+  PetscErrorCode ierr;
+  const int      nres = 6;  // steps, volume, area, errinf, erravg, seconds
+  DM             da;
+  MPI_Comm       com;
+  PetscMPIInt    wrank, wsize, rank;
+  FILE           *fp;
+  char           line[1024], *c,
+                 checkpointbase[PETSC_MAX_PATH_LEN], snapshotbase[PETSC_MAX_PATH_LEN];
+  int            M = 0, m, group, steps;
+  double         *params = NULL, *res, *allres, p[3], t0, *r;
+  PetscBool      started = PETSC_FALSE;
+
+  PetscFunctionBeginUser;
+  ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+  ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+  ierr = MPI_Comm_rank(com,&rank); CHKERRQ(ierr);
+  ierr = MPI_Comm_rank(PETSC_COMM_WORLD,&wrank); CHKERRQ(ierr);
+  ierr = MPI_Comm_size(PETSC_COMM_WORLD,&wsize); CHKERRQ(ierr);
+  group = (user->ensemblegroups > 1) ? (wrank * user->ensemblegroups) / wsize : 0;
+
+  // rank 0 reads the table, in two passes, and broadcasts it
+  ierr = PetscFOpen(PETSC_COMM_WORLD,user->ensemblename,"r",&fp); CHKERRQ(ierr);
+  if (wrank == 0) {
+      while (fgets(line,sizeof(line),fp)) {
+          for (c = line; *c; c++)
+              if (*c == ',')  *c = ' ';
+          if (sscanf(line,"%lf %lf %lf",&p[0],&p[1],&p[2]) == 3)
+              M++;
+      }
+      ierr = PetscMalloc1(3*M,&params); CHKERRQ(ierr);
+      rewind(fp);
+      m = 0;
+      while (fgets(line,sizeof(line),fp) && m < M) {
+          for (c = line; *c; c++)
+              if (*c == ',')  *c = ' ';
+          if (sscanf(line,"%lf %lf %lf",&p[0],&p[1],&p[2]) == 3) {
+              params[3*m+0] = p[0];
+              params[3*m+1] = p[1];
+              params[3*m+2] = p[2];
+              m++;
+          }
+      }
+  }
+  ierr = PetscFClose(PETSC_COMM_WORLD,fp); CHKERRQ(ierr);
+  ierr = MPI_Bcast(&M,1,MPI_INT,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+  if (M == 0) {
+      SETERRQ1(PETSC_COMM_WORLD,9,"no members found in ensemble table %s\n",
+               user->ensemblename);
+  }
+  if (wrank != 0) {
+      ierr = PetscMalloc1(3*M,&params); CHKERRQ(ierr);
+  }
+  ierr = MPI_Bcast(params,3*M,MPI_DOUBLE,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+  ierr = PetscPrintf(PETSC_COMM_WORLD,"running %d ensemble members on %d group(s) ...\n",
+                     M,user->ensemblegroups); CHKERRQ(ierr);
+
+  ierr = PetscCalloc1(nres*M,&res); CHKERRQ(ierr);
+  ierr = PetscMalloc1(nres*M,&allres); CHKERRQ(ierr);
+  strcpy(checkpointbase,user->checkpointname);
+  strcpy(snapshotbase,user->snapshotroot);
+  for (m = 0; m < M; m++) {
+      if (m % user->ensemblegroups != group)
+          continue;
+      user->cmb->ela = params[3*m+0];
+      user->A_ice = params[3*m+1];
+      user->maxslide = params[3*m+2] / user->secpera;
+      user->Gamma = 2.0 * PetscPowReal(user->rho_ice*user->g,user->n_ice)
+                        * user->A_ice / (user->n_ice+2.0);
+      user->dtexplicitsum = 0.0;
+      user->nextcheckpoint = user->checkpointdt;
+      ierr = MemberFileName(checkpointbase,m,user->checkpointname,
+                            sizeof(user->checkpointname)); CHKERRQ(ierr);
+      ierr = MemberFileName(snapshotbase,m,user->snapshotroot,
+                            sizeof(user->snapshotroot)); CHKERRQ(ierr);
+      ierr = PetscSNPrintf(user->label,sizeof(user->label),"[member %d] ",m); CHKERRQ(ierr);
+      ierr = TSSetTime(ts,0.0); CHKERRQ(ierr);
+      ierr = TSSetStepNumber(ts,0); CHKERRQ(ierr);
+      ierr = TSSetTimeStep(ts,user->dtinit); CHKERRQ(ierr);
+      if (!user->ensemblewarm || !started) {
+          ierr = FormInitialH(ts,H,user); CHKERRQ(ierr);
+      }
+      started = PETSC_TRUE;
+      ierr = PetscPrintf(com,"ensemble member %d:  ela %.1f m,  A %.4e Pa-3 s-1,  maxslide %.1f m/a\n",
+                         m,params[3*m+0],params[3*m+1],params[3*m+2]); CHKERRQ(ierr);
+      r = res + nres*m;
+      t0 = MPI_Wtime();
+      ierr = IceSolve(ts,H,user); CHKERRQ(ierr);
+      r[5] = MPI_Wtime() - t0;
+      ierr = TSGetStepNumber(ts,&steps); CHKERRQ(ierr);
+      r[0] = (double)steps;
+      ierr = IceVolumeArea(da,H,user,&(r[1]),&(r[2])); CHKERRQ(ierr);
+      if (user->verif > 0) {
+          ierr = VerifErrors(ts,H,user,&(r[3]),&(r[4])); CHKERRQ(ierr);
+      }
+      if (rank != 0) {  // only one process per group contributes to the sum below
+          ierr = PetscMemzero(r,nres*sizeof(double)); CHKERRQ(ierr);
+      }
+  }
+
+  strcpy(user->checkpointname,checkpointbase);
+  strcpy(user->snapshotroot,snapshotbase);
+  strcpy(user->label,"");
+
+  // gather results and write CSV
+  ierr = MPI_Reduce(res,allres,nres*M,MPI_DOUBLE,MPI_SUM,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+  ierr = PetscFOpen(PETSC_COMM_WORLD,user->ensemblecsv,"w",&fp); CHKERRQ(ierr);
+  ierr = PetscFPrintf(PETSC_COMM_WORLD,fp,
+      "member,ela_m,A_Pa-3s-1,maxslide_ma-1,steps,volume_km3,area_km2,"
+      "errinf_m,erravg_m,seconds\n"); CHKERRQ(ierr);
+  for (m = 0; m < M; m++) {
+      r = allres + nres*m;
+      ierr = PetscFPrintf(PETSC_COMM_WORLD,fp,"%d,%.3f,%.6e,%.3f,%d,%.6e,%.6e,%.6e,%.6e,%.3f\n",
+          m,params[3*m+0],params[3*m+1],params[3*m+2],(int)r[0],
+          r[1]/1.0e9,r[2]/1.0e6,r[3],r[4],r[5]); CHKERRQ(ierr);
+  }
+  ierr = PetscFClose(PETSC_COMM_WORLD,fp); CHKERRQ(ierr);
+  ierr = PetscPrintf(PETSC_COMM_WORLD,"ensemble results written to %s\n",
+                     user->ensemblecsv); CHKERRQ(ierr);
+  ierr = PetscFree(params); CHKERRQ(ierr);
+  ierr = PetscFree(res); CHKERRQ(ierr);
+  ierr = PetscFree(allres); CHKERRQ(ierr);
+  PetscFunctionReturn(0);
+}
+
+// volume and area of ice sheet, counting only where H > 1 m
+PetscErrorCode IceVolumeArea(DM da, Vec H, AppCtx *user, double *vol, double *area) {
     PetscErrorCode ierr;
-    AppCtx         *user = (AppCtx*)ctx;
-    double         lvol = 0.0, vol, larea = 0.0, area, darea, **aH;
+    double         loc[2] = {0.0, 0.0}, glob[2], darea, **aH;
     int            j, k;
     MPI_Comm       com;
-    DM             da;
     DMDALocalInfo  info;
 
     PetscFunctionBeginUser;
-    ierr = TSGetDM(ts,&da);CHKERRQ(ierr);
     ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
     darea = user->L * user->L / (double)(info.mx * info.my);
     ierr = DMDAVecGetArrayRead(da,H,&aH); CHKERRQ(ierr);
     for (k = info.ys; k < info.ys + info.ym; k++) {
         for (j = info.xs; j < info.xs + info.xm; j++) {
             if (aH[k][j] > 1.0) {  // for volume/area its helpful to not count tinys
-                larea += darea;
-                lvol += aH[k][j];
+                loc[0] += aH[k][j];
+                loc[1] += darea;
             }
         }
     }
     ierr = DMDAVecRestoreArrayRead(da,H,&aH); CHKERRQ(ierr);
-    lvol *= darea;
+    loc[0] *= darea;
+    // volume and area in one reduction
     ierr = PetscObjectGetComm((PetscObject)(da),&com); CHKERRQ(ierr);
-    ierr = MPI_Allreduce(&lvol,&vol,1,MPI_DOUBLE,MPI_SUM,com); CHKERRQ(ierr);
-    ierr = MPI_Allreduce(&larea,&area,1,MPI_DOUBLE,MPI_SUM,com); CHKERRQ(ierr);
-    ierr = PetscPrintf(PETSC_COMM_WORLD,
-        "%3d: time %.3f a,  volume %.1f 10^3 km^3,  area %.1f 10^3 km^2\n",
-        step,time/user->secpera,vol/1.0e12,area/1.0e9); CHKERRQ(ierr);
+    ierr = MPI_Allreduce(loc,glob,2,MPI_DOUBLE,MPI_SUM,com); CHKERRQ(ierr);
+    *vol = glob[0];
+    *area = glob[1];
+    PetscFunctionReturn(0);
+}
+
+// this basic monitor gives current time, volume, area
+PetscErrorCode IceMonitor(TS ts, int step, double time, Vec H, void *ctx) {
+    PetscErrorCode ierr;
+    AppCtx         *user = (AppCtx*)ctx;
+    double         vol, area;
+    MPI_Comm       com;
+    DM             da;
+
+    PetscFunctionBeginUser;
+    ierr = TSGetDM(ts,&da);CHKERRQ(ierr);
+    ierr = PetscObjectGetComm((PetscObject)(da),&com); CHKERRQ(ierr);
+    ierr = IceVolumeArea(da,H,user,&vol,&area); CHKERRQ(ierr);
+    ierr = PetscPrintf(com,
+        "%s%3d: time %.3f a,  volume %.1f 10^3 km^3,  area %.1f 10^3 km^2\n",
+        user->label,step,time/user->secpera,vol/1.0e12,area/1.0e9); CHKERRQ(ierr);
     PetscFunctionReturn(0);
 }
 
@@ -445,26 +885,337 @@ PetscErrorCode ExplicitLimitsMonitor(TS ts, int step, double time, Vec H, void *
     ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
     dd = PetscMin(user->L / (double)(info.mx), user->L / (double)(info.my));
     if (maxD <= 0.0) {
-        ierr = PetscPrintf(PETSC_COMM_WORLD,
-            "    [NO -ice_dtlimits output: maxD is zero]\n"); CHKERRQ(ierr);
+        ierr = PetscPrintf(com,
+            "%s    [NO -ice_dtlimits output: maxD is zero]\n",user->label); CHKERRQ(ierr);
     } else {
         dtD = dd * dd / (4.0*maxD);
-        ierr = PetscPrintf(PETSC_COMM_WORLD,
-            "    max D_SIA %.3f m2s-1,  max |V_slide| %.3f ma-1,  dtD %.3e a",
-            maxD,maxV*user->secpera,dtD/user->secpera); CHKERRQ(ierr);
+        ierr = PetscPrintf(com,
+            "%s    max D_SIA %.3f m2s-1,  max |V_slide| %.3f ma-1,  dtD %.3e a",
+            user->label,maxD,maxV*user->secpera,dtD/user->secpera); CHKERRQ(ierr);
         if (maxV > 0.0) {
             dtCFL = dd / maxV;
-            ierr = PetscPrintf(PETSC_COMM_WORLD,
+            ierr = PetscPrintf(com,
                 ",  dtCFL %.3e a\n",dtCFL/user->secpera); CHKERRQ(ierr);
             user->dtexplicitsum += PetscMin(dtD,dtCFL);
         } else {
-            ierr = PetscPrintf(PETSC_COMM_WORLD,"\n"); CHKERRQ(ierr);
+            ierr = PetscPrintf(com,"\n"); CHKERRQ(ierr);
             user->dtexplicitsum += dtD;
         }
     }
     PetscFunctionReturn(0);
 }
 
+/* Snapshots of H are written with MPI-IO nonblocking writes so that time
+stepping continues while the data goes to disk.  Each process copies its
+owned block of H into a staging buffer and starts an MPI_File_iwrite() through
+a subarray file view.  That write is completed when the next snapshot is
+started, or by SnapshotFinish().  The files are in PETSc binary format (big
+endian header (VEC_FILE_CLASSID, N) then N values in natural ordering), the
+same as VecView() on the DMDA Vec, so they can be read with VecLoad() or
+PetscBinaryIO.py, and by -ice_initial to start a new run.  */
+static void SwapBytes(void *data, size_t size, int n) {
+#if !defined(PETSC_WORDS_BIGENDIAN)
+    unsigned char *c = (unsigned char*)data, tmp;
+    size_t        i;
+    int           m;
+    for (m = 0; m < n; m++, c += size) {
+        for (i = 0; i < size/2; i++) {
+            tmp = c[i];  c[i] = c[size-1-i];  c[size-1-i] = tmp;
+        }
+    }
+#endif
+}
+
+static PetscErrorCode SnapshotComplete(SnapshotWriter *snap) {
+    PetscErrorCode ierr;
+    PetscFunctionBeginUser;
+    if (snap->pending) {
+        ierr = MPI_Wait(&(snap->req),MPI_STATUS_IGNORE); CHKERRQ(ierr);
+        ierr = MPI_File_close(&(snap->fh)); CHKERRQ(ierr);
+        snap->pending = PETSC_FALSE;
+    }
+    PetscFunctionReturn(0);
+}
+
+PetscErrorCode SnapshotMonitor(TS ts, int step, double time, Vec H, void *ctx) {
+    PetscErrorCode ierr;
+    AppCtx         *user = (AppCtx*)ctx;
+    SnapshotWriter *snap = &(user->snap);
+    MPI_Comm       com;
+    PetscMPIInt    rank;
+    MPI_Datatype   block;
+    DM             da;
+    DMDALocalInfo  info;
+    char           filename[PETSC_MAX_PATH_LEN+32];
+    int            j, k, sizes[2], subsizes[2], starts[2];
+    PetscInt       header[2];
+    double         **aH;
+
+    PetscFunctionBeginUser;
+    if (step % user->snapshotevery != 0) {
+        PetscFunctionReturn(0);
+    }
+    ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+    ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+    ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+    ierr = MPI_Comm_rank(com,&rank); CHKERRQ(ierr);
+
+    // staging buffer is reused, so the previous write must be done
+    ierr = SnapshotComplete(snap); CHKERRQ(ierr);
+    if (!snap->buf) {
+        ierr = PetscMalloc1(info.xm*info.ym,&(snap->buf)); CHKERRQ(ierr);
+    }
+    ierr = DMDAVecGetArrayRead(da,H,&aH); CHKERRQ(ierr);
+    for (k = info.ys; k < info.ys + info.ym; k++) {
+        for (j = info.xs; j < info.xs + info.xm; j++) {
+            snap->buf[(k-info.ys)*info.xm + (j-info.xs)] = aH[k][j];
+        }
+    }
+    ierr = DMDAVecRestoreArrayRead(da,H,&aH); CHKERRQ(ierr);
+    SwapBytes(snap->buf,sizeof(double),info.xm*info.ym);
+
+    ierr = PetscSNPrintf(filename,sizeof(filename),"%s_%d.dat",
+                         user->snapshotroot,step); CHKERRQ(ierr);
+    ierr = MPI_File_open(com,filename,MPI_MODE_WRONLY | MPI_MODE_CREATE,
+                         MPI_INFO_NULL,&(snap->fh)); CHKERRQ(ierr);
+    ierr = MPI_File_set_size(snap->fh,0); CHKERRQ(ierr);
+    if (rank == 0) {
+        header[0] = VEC_FILE_CLASSID;
+        header[1] = info.mx * info.my;
+        SwapBytes(header,sizeof(PetscInt),2);
+        ierr = MPI_File_write_at(snap->fh,0,header,(int)sizeof(header),MPI_BYTE,
+                                 MPI_STATUS_IGNORE); CHKERRQ(ierr);
+    }
+    sizes[0] = info.my;     sizes[1] = info.mx;
+    subsizes[0] = info.ym;  subsizes[1] = info.xm;
+    starts[0] = info.ys;    starts[1] = info.xs;
+    ierr = MPI_Type_create_subarray(2,sizes,subsizes,starts,MPI_ORDER_C,
+                                    MPI_DOUBLE,&block); CHKERRQ(ierr);
+    ierr = MPI_Type_commit(&block); CHKERRQ(ierr);
+    ierr = MPI_File_set_view(snap->fh,(MPI_Offset)sizeof(header),MPI_DOUBLE,block,
+                             "native",MPI_INFO_NULL); CHKERRQ(ierr);
+    ierr = MPI_Type_free(&block); CHKERRQ(ierr);
+    ierr = MPI_File_iwrite(snap->fh,snap->buf,info.xm*info.ym,MPI_DOUBLE,
+                           &(snap->req)); CHKERRQ(ierr);
+    snap->pending = PETSC_TRUE;
+    ierr = PetscPrintf(com,"    [snapshot at step %d and time %.3f a started to %s]\n",
+                       step,time/user->secpera,filename); CHKERRQ(ierr);
+    PetscFunctionReturn(0);
+}
+
+// complete the last snapshot write, if any, and free the staging buffer
+PetscErrorCode SnapshotFinish(AppCtx *user) {
+    PetscErrorCode ierr;
+    PetscFunctionBeginUser;
+    ierr = SnapshotComplete(&(user->snap)); CHKERRQ(ierr);
+    ierr = PetscFree(user->snap.buf); CHKERRQ(ierr);
+    PetscFunctionReturn(0);
+}
+
+// compare residual and Jacobian at H computed with multiplied powers (user->nint > 0)
+// against those computed with PetscPowReal() (user->nint = 0); use with
+// -ice_verif 1|2 to check on the dome and Halfar cases
+PetscErrorCode FastPowCheck(TS ts, Vec H, AppCtx *user) {
+    PetscErrorCode ierr;
+    const int      nint = user->nint;
+    DM             da;
+    Vec            Hdot, Ffast, Fref;
+    Mat            Jfast, Jref;
+    double         t, normF, normdF, normJ, normdJ, relF, relJ;
+
+    PetscFunctionBeginUser;
+    if (nint == 0) {
+        ierr = PetscPrintf(PETSC_COMM_WORLD,
+            "fastpow check: n = %g is not an integer or -ice_fastpow is false; nothing to compare\n",
+            user->n_ice); CHKERRQ(ierr);
+        PetscFunctionReturn(0);
+    }
+    ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+    ierr = TSGetTime(ts,&t); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&Hdot); CHKERRQ(ierr);
+    ierr = VecSet(Hdot,0.0); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&Ffast); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&Fref); CHKERRQ(ierr);
+    ierr = DMCreateMatrix(da,&Jfast); CHKERRQ(ierr);
+    ierr = DMCreateMatrix(da,&Jref); CHKERRQ(ierr);
+    ierr = TSComputeIFunction(ts,t,H,Hdot,Ffast,PETSC_FALSE); CHKERRQ(ierr);
+    ierr = TSComputeIJacobian(ts,t,H,Hdot,0.0,Jfast,Jfast,PETSC_FALSE); CHKERRQ(ierr);
+    user->nint = 0;
+    ierr = TSComputeIFunction(ts,t,H,Hdot,Fref,PETSC_FALSE); CHKERRQ(ierr);
+    ierr = TSComputeIJacobian(ts,t,H,Hdot,0.0,Jref,Jref,PETSC_FALSE); CHKERRQ(ierr);
+    user->nint = nint;
+    ierr = VecNorm(Fref,NORM_INFINITY,&normF); CHKERRQ(ierr);
+    ierr = VecAXPY(Ffast,-1.0,Fref); CHKERRQ(ierr);
+    ierr = VecNorm(Ffast,NORM_INFINITY,&normdF); CHKERRQ(ierr);
+    ierr = MatNorm(Jref,NORM_INFINITY,&normJ); CHKERRQ(ierr);
+    ierr = MatAXPY(Jfast,-1.0,Jref,SAME_NONZERO_PATTERN); CHKERRQ(ierr);
+    ierr = MatNorm(Jfast,NORM_INFINITY,&normdJ); CHKERRQ(ierr);
+    // differences are roundoff, which varies with compiler and process count,
+    // so only report whether they are below a threshold
+    relF = (normF > 0.0) ? normdF/normF : normdF;
+    relJ = (normJ > 0.0) ? normdJ/normJ : normdJ;
+    ierr = PetscPrintf(PETSC_COMM_WORLD,
+        "fastpow check (n = %d): |F_fast-F_ref|_inf/|F_ref|_inf %s 1e-12,"
+        "  |J_fast-J_ref|_inf/|J_ref|_inf %s 1e-12\n",
+        nint,(relF < 1.0e-12) ? "<" : ">=",(relJ < 1.0e-12) ? "<" : ">="); CHKERRQ(ierr);
+    if (relF >= 1.0e-12 || relJ >= 1.0e-12) {
+        ierr = PetscPrintf(PETSC_COMM_WORLD,
+            "fastpow check: relative differences are %.3e and %.3e\n",relF,relJ); CHKERRQ(ierr);
+    }
+    VecDestroy(&Hdot);  VecDestroy(&Ffast);  VecDestroy(&Fref);
+    MatDestroy(&Jfast);  MatDestroy(&Jref);
+    PetscFunctionReturn(0);
+}
+
+/* Checkpoints are PETSc binary files with two Vecs.  The first has length 6
+and holds the time-stepping state
+    (t, dt, step, mx, my, dtexplicitsum)
+where dt is the step size proposed by TSAdapt for the next step.  This dt is
+the only TSAdapt state restored.  That is all a one-step method (e.g.
+arkimex or beuler) needs to continue as if uninterrupted, but a multistep
+method (-ts_type bdf) restarts at first order from H alone.  The
+second is H.  VecView() of a DMDA Vec writes in the natural (grid) ordering,
+so a restart can use a different number of processes and still continue
+from bit-identical H.  The file is written to a temporary name and then
+renamed, so a run killed while writing leaves the previous checkpoint.  */
+static PetscErrorCode WriteCheckpoint(TS ts, Vec H, AppCtx *user) {
+    PetscErrorCode ierr;
+    MPI_Comm       com;
+    PetscMPIInt    rank;
+    DM             da;
+    DMDALocalInfo  info;
+    Vec            state;
+    PetscViewer    viewer;
+    char           tmpname[PETSC_MAX_PATH_LEN+8];
+    double         t, dt, *astate;
+    int            step, renamefailed = 0;
+
+    PetscFunctionBeginUser;
+    ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+    ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+    ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+    ierr = MPI_Comm_rank(com,&rank); CHKERRQ(ierr);
+    ierr = TSGetTime(ts,&t); CHKERRQ(ierr);
+    ierr = TSGetTimeStep(ts,&dt); CHKERRQ(ierr);
+    ierr = TSGetStepNumber(ts,&step); CHKERRQ(ierr);
+
+    ierr = VecCreateMPI(com,(rank == 0) ? 6 : 0,6,&state); CHKERRQ(ierr);
+    ierr = PetscObjectSetName((PetscObject)state,"tsstate"); CHKERRQ(ierr);
+    ierr = VecGetArray(state,&astate); CHKERRQ(ierr);
+    if (rank == 0) {
+        astate[0] = t;
+        astate[1] = dt;
+        astate[2] = (double)step;
+        astate[3] = (double)info.mx;
+        astate[4] = (double)info.my;
+        astate[5] = user->dtexplicitsum;
+    }
+    ierr = VecRestoreArray(state,&astate); CHKERRQ(ierr);
+
+    ierr = PetscSNPrintf(tmpname,sizeof(tmpname),"%s.tmp",user->checkpointname); CHKERRQ(ierr);
+    ierr = PetscViewerCreate(com,&viewer); CHKERRQ(ierr);
+    ierr = PetscViewerSetType(viewer,PETSCVIEWERBINARY); CHKERRQ(ierr);
+    ierr = PetscViewerBinarySkipInfo(viewer); CHKERRQ(ierr);
+    ierr = PetscViewerFileSetMode(viewer,FILE_MODE_WRITE); CHKERRQ(ierr);
+    ierr = PetscViewerFileSetName(viewer,tmpname); CHKERRQ(ierr);
+    ierr = VecView(state,viewer); CHKERRQ(ierr);
+    ierr = VecView(H,viewer); CHKERRQ(ierr);
+    ierr = PetscViewerDestroy(&viewer); CHKERRQ(ierr);
+    VecDestroy(&state);
+    // all processes wait for the rename and learn whether it failed
+    if (rank == 0)
+        renamefailed = (rename(tmpname,user->checkpointname) != 0);
+    ierr = MPI_Bcast(&renamefailed,1,MPI_INT,0,com); CHKERRQ(ierr);
+    if (renamefailed) {
+        SETERRQ1(com,5,"could not rename checkpoint file to %s\n",
+                 user->checkpointname);
+    }
+    ierr = PetscPrintf(com,"    [checkpoint at step %d and time %.3f a written to %s]\n",
+                       step,t/user->secpera,user->checkpointname); CHKERRQ(ierr);
+    PetscFunctionReturn(0);
+}
+
+// write a checkpoint every checkpointevery steps and/or every checkpointdt model
+// time; not at step zero or at the step just read by a restart
+PetscErrorCode CheckpointMonitor(TS ts, int step, double time, Vec H, void *ctx) {
+    PetscErrorCode ierr;
+    AppCtx         *user = (AppCtx*)ctx;
+    PetscBool      write = PETSC_FALSE;
+
+    PetscFunctionBeginUser;
+    if (step <= 0 || step == user->restartstep) {
+        PetscFunctionReturn(0);
+    }
+    if (user->checkpointevery > 0 && step % user->checkpointevery == 0)
+        write = PETSC_TRUE;
+    if (user->checkpointdt > 0.0 && time >= user->nextcheckpoint) {
+        write = PETSC_TRUE;
+        while (user->nextcheckpoint <= time)
+            user->nextcheckpoint += user->checkpointdt;
+    }
+    if (write) {
+        ierr = WriteCheckpoint(ts,H,user); CHKERRQ(ierr);
+    }
+    PetscFunctionReturn(0);
+}
+
+// read checkpoint written by WriteCheckpoint() into H and the TS
+PetscErrorCode ReadCheckpoint(TS ts, Vec H, AppCtx *user) {
+    PetscErrorCode ierr;
+    MPI_Comm       com;
+    DM             da;
+    DMDALocalInfo  info;
+    Vec            state;
+    PetscViewer    viewer;
+    double         sloc[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0}, s[6], *astate;
+    int            n, nloc;
+
+    PetscFunctionBeginUser;
+    ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+    ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+    ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+    ierr = PetscViewerBinaryOpen(com,user->restartname,FILE_MODE_READ,&viewer); CHKERRQ(ierr);
+    ierr = VecCreate(com,&state); CHKERRQ(ierr);
+    ierr = VecSetFromOptions(state); CHKERRQ(ierr);
+    ierr = VecLoad(state,viewer); CHKERRQ(ierr);
+    ierr = VecGetSize(state,&n); CHKERRQ(ierr);
+    if (n != 6) {
+        SETERRQ1(com,6,"file %s is not an ice.c checkpoint\n",user->restartname);
+    }
+    // every process needs the state, but VecLoad() distributes it
+    ierr = VecGetLocalSize(state,&nloc); CHKERRQ(ierr);
+    ierr = VecGetArray(state,&astate); CHKERRQ(ierr);
+    if (nloc > 0) {
+        int rstart;
+        ierr = VecGetOwnershipRange(state,&rstart,NULL); CHKERRQ(ierr);
+        for (n = 0; n < nloc; n++)
+            sloc[rstart+n] = astate[n];
+    }
+    ierr = VecRestoreArray(state,&astate); CHKERRQ(ierr);
+    ierr = MPI_Allreduce(sloc,s,6,MPI_DOUBLE,MPI_SUM,com); CHKERRQ(ierr);
+    VecDestroy(&state);
+    if ((int)s[3] != info.mx || (int)s[4] != info.my) {
+        SETERRQ4(com,7,"checkpoint grid %d x %d differs from current grid %d x %d\n",
+                 (int)s[3],(int)s[4],info.mx,info.my);
+    }
+    ierr = VecLoad(H,viewer); CHKERRQ(ierr);
+    ierr = PetscViewerDestroy(&viewer); CHKERRQ(ierr);
+    ierr = TSSetTime(ts,s[0]); CHKERRQ(ierr);
+    ierr = TSSetTimeStep(ts,s[1]); CHKERRQ(ierr);
+    ierr = TSSetStepNumber(ts,(int)s[2]); CHKERRQ(ierr);
+    user->restartstep = (int)s[2];
+    user->dtexplicitsum = s[5];
+    if (user->checkpointdt > 0.0) {
+        user->nextcheckpoint = user->checkpointdt;
+        while (user->nextcheckpoint <= s[0])
+            user->nextcheckpoint += user->checkpointdt;
+    }
+    ierr = PetscPrintf(com,"restarting from %s at step %d and time %.3f a with dt %.3f a\n",
+                       user->restartname,(int)s[2],s[0]/user->secpera,s[1]/user->secpera);
+                       CHKERRQ(ierr);
+    PetscFunctionReturn(0);
+}
+
 PetscErrorCode FormBedLocal(DMDALocalInfo *info, int stencilwidth, double **ab, AppCtx *user) {
   int          j,k,r,s;
   const double dx = user->L / (double)(info->mx),
@@ -515,6 +1266,55 @@ typedef struct {
     double x,y;
 } Grad;
 
+/* Powers in the SIA formulas.  If the Glen exponent n is an integer, which
+includes the default n=3, then user->nint = n and these powers are computed by
+a fixed sequence of multiplications (and at most one square root) instead of
+PetscPowReal().  Otherwise, or with -ice_fastpow false, user->nint = 0 and
+PetscPowReal() is used.  */
+static double IntPow(double x, int p) {
+    double x2, y;
+    switch (p) {
+        case 0 :  return 1.0;
+        case 1 :  return x;
+        case 2 :  return x * x;
+        case 3 :  return x * x * x;
+        case 4 :  x2 = x * x;  return x2 * x2;
+        case 5 :  x2 = x * x;  return x2 * x2 * x;
+        case 6 :  x2 = x * x;  return x2 * x2 * x2;
+        default :
+            y = 1.0;
+            for (; p > 0; p--)
+                y *= x;
+            return y;
+    }
+}
+
+// x^(m/2) for x > 0 and integer m
+static double HalfIntPow(double x, int m) {
+    if (m < 0)
+        return 1.0 / HalfIntPow(x,-m);
+    else if (m % 2 == 0)
+        return IntPow(x,m/2);
+    else
+        return IntPow(x,(m-1)/2) * PetscSqrtReal(x);
+}
+
+// |H|^{n+p}
+static double Hpow(double H, int p, const AppCtx *user) {
+    if (user->nint > 0)
+        return IntPow(PetscAbsReal(H),user->nint+p);
+    else
+        return PetscPowReal(PetscAbsReal(H),user->n_ice+p);
+}
+
+// (slopesqr)^{(n+p)/2} where slopesqr > 0
+static double slopepow(double slopesqr, int p, const AppCtx *user) {
+    if (user->nint > 0)
+        return HalfIntPow(slopesqr,user->nint+p);
+    else
+        return PetscPowReal(slopesqr,(user->n_ice+p)/2.0);
+}
+
 /* We factor the SIA flux as
     q = - H^{n+2} sigma(|grad s|) grad s
 where sigma is the slope-dependent part
@@ -528,7 +1328,7 @@ static double sigma(Grad gH, Grad gb, const AppCtx *user) {
         const double sx = gH.x + gb.x,
                      sy = gH.y + gb.y,
                      slopesqr = sx * sx + sy * sy + user->delta * user->delta;
-        return user->Gamma * PetscPowReal(slopesqr,(n-1.0)/2);
+        return user->Gamma * slopepow(slopesqr,-1,user);
     } else {
         return user->Gamma;
     }
@@ -547,7 +1347,7 @@ static double DsigmaDl(Grad gH, Grad gb, Grad dgHdl, const AppCtx *user) {
         const double sx = gH.x + gb.x,
                      sy = gH.y + gb.y,
                      slopesqr = sx * sx + sy * sy + user->delta * user->delta,
-                     tmp = user->Gamma * (n-1) * PetscPowReal(slopesqr,(n-3.0)/2);
+                     tmp = user->Gamma * (n-1) * slopepow(slopesqr,-3,user);
         return tmp * sx * dgHdl.x + tmp * sy * dgHdl.y;
     } else {
         return 0.0;
@@ -574,7 +1374,7 @@ static Grad DWDl(double dsigmadl, Grad gb) {
      D(eps) = (1-eps) sigma H^{n+2} + eps D_0
 so D(1)=D_0 and D(0)=sigma H^{n+2}. */
 static double DCS(double sigma, double H, const AppCtx *user) {
-  return (1.0 - user->eps) * sigma * PetscPowReal(PetscAbsReal(H),user->n_ice+2.0)
+  return (1.0 - user->eps) * sigma * Hpow(H,2,user)
          + user->eps * user->D0;
 }
 
@@ -585,8 +1385,8 @@ it follows that
            = (1-eps) H^{n+1} [ (d sigma / dl) H + sigma (n+2) (d H / dl) ]    */
 static double DDCSDl(double sigma, double dsigmadl, double H, double dHdl,
                      const AppCtx *user) {
-    const double Hpow = PetscPowReal(PetscAbsReal(H),user->n_ice+1.0);
-    return (1.0 - user->eps) * Hpow * ( dsigmadl * H + sigma * (user->n_ice+2.0) * dHdl );
+    const double Hnp1 = Hpow(H,1,user);
+    return (1.0 - user->eps) * Hnp1 * ( dsigmadl * H + sigma * (user->n_ice+2.0) * dHdl );
 }
 
 /* Flux component from the non-sliding SIA on a general bed. */
@@ -600,9 +1400,9 @@ PetscErrorCode SIAflux(Grad gH, Grad gb, double H, double Hup, PetscBool xdir,
       *D = myD;
   }
   if (xdir && q) {
-      *q = - myD * gH.x + myW.x * PetscPowReal(PetscAbsReal(Hup),user->n_ice+2.0);
+      *q = - myD * gH.x + myW.x * Hpow(Hup,2,user);
   } else {
-      *q = - myD * gH.y + myW.y * PetscPowReal(PetscAbsReal(Hup),user->n_ice+2.0);
+      *q = - myD * gH.y + myW.y * Hpow(Hup,2,user);
   }
   PetscFunctionReturn(0);
 }
@@ -610,7 +1410,7 @@ PetscErrorCode SIAflux(Grad gH, Grad gb, double H, double Hup, PetscBool xdir,
 static double DSIAfluxDl(Grad gH, Grad gb, Grad dgHdl,
                          double H, double dHdl, double Hup, double dHupdl,
                          PetscBool xdir, const AppCtx *user) {
-    const double Huppow   = PetscPowReal(PetscAbsReal(Hup),user->n_ice+1.0),
+    const double Huppow   = Hpow(Hup,1,user),
                  dHuppow  = (user->n_ice+2.0) * Huppow * dHupdl,
                  mysig    = sigma(gH,gb,user),
                  myD      = DCS(mysig,H,user),
@@ -721,6 +1521,193 @@ static const double locx[4] = {  0.5, 0.75,  0.5, 0.25},
                     locy[4] = { 0.25,  0.5, 0.75,  0.5};
 
 
+/* The bed elevation b(x,y) does not depend on t or H, but evaluating it costs
+32 sin() calls per point.  So b on the ghosted local patch, and grad b at the
+c=0,1,2,3 points of each element, are computed once per DMDA and attached to
+it.  A new DMDA (e.g. from grid sequencing or refinement) gets its own.  The
+flux buffer used by FormIFunctionLocal() has a size which depends only on
+the DMDA, so it is kept here too.  */
+typedef struct {
+    Vec    b;    // bed elevation on ghosted patch; a sequential Vec of size gxm*gym
+    Grad   *gb;  // grad b at points c in elements (j,k) with xs-1 <= j < xs+xm
+                 //   and ys-1 <= k < ys+ym; use BedGradIndex() to index
+    double *qbuf;// two rows of 4*(xm+1) fluxes; see FormIFunctionLocal()
+} BedCache;
+
+// index of element (j,k), with xs-1 <= j < xs+xm and ys-1 <= k < ys+ym,
+// in arrays over the elements of the local patch
+static int ElementIndex(DMDALocalInfo *info, int j, int k) {
+    return (k - info->ys + 1) * (info->xm + 1) + (j - info->xs + 1);
+}
+
+static int BedGradIndex(DMDALocalInfo *info, int j, int k, int c) {
+    return 4 * ElementIndex(info,j,k) + c;
+}
+
+static PetscErrorCode DestroyBedCache(void *ctx) {
+    BedCache *bc = (BedCache*)ctx;
+    VecDestroy(&(bc->b));
+    PetscFree(bc->gb);
+    PetscFree(bc->qbuf);
+    PetscFree(bc);
+    return 0;
+}
+
+// get the BedCache attached to info->da, creating it on first call
+PetscErrorCode GetBedCache(DMDALocalInfo *info, AppCtx *user, BedCache **bc) {
+    PetscErrorCode ierr;
+    PetscContainer container = NULL;
+    const double   dx = user->L / (double)(info->mx),
+                   dy = user->L / (double)(info->my);
+    double         **ab;
+    int            j, k, c;
+
+    PetscFunctionBeginUser;
+    ierr = PetscObjectQuery((PetscObject)(info->da),"ice_bedcache",
+                            (PetscObject*)&container); CHKERRQ(ierr);
+    if (container) {
+        ierr = PetscContainerGetPointer(container,(void**)bc); CHKERRQ(ierr);
+        PetscFunctionReturn(0);
+    }
+    ierr = PetscNew(bc); CHKERRQ(ierr);
+    // a Vec without an attached DM avoids a DM <--> Vec reference cycle
+    ierr = VecCreateSeq(PETSC_COMM_SELF,info->gxm*info->gym,&((*bc)->b)); CHKERRQ(ierr);
+    ierr = VecSet((*bc)->b,0.0); CHKERRQ(ierr);
+    ierr = DMDAVecGetArray(info->da,(*bc)->b,&ab); CHKERRQ(ierr);
+    if (user->verif == 0) {
+        ierr = FormBedLocal(info,1,ab,user); CHKERRQ(ierr);  // get stencil width
+    }
+    ierr = PetscMalloc1(4*(info->xm+1)*(info->ym+1),&((*bc)->gb)); CHKERRQ(ierr);
+    for (k = info->ys-1; k < info->ys + info->ym; k++) {
+        for (j = info->xs-1; j < info->xs + info->xm; j++) {
+            for (c=0; c<4; c++) {
+                (*bc)->gb[BedGradIndex(info,j,k,c)]
+                    = gradfatptArray(j,k,locx[c],locy[c],dx,dy,ab);
+            }
+        }
+    }
+    ierr = DMDAVecRestoreArray(info->da,(*bc)->b,&ab); CHKERRQ(ierr);
+    ierr = PetscMalloc1(8*(info->xm+1),&((*bc)->qbuf)); CHKERRQ(ierr);
+    ierr = PetscContainerCreate(PETSC_COMM_SELF,&container); CHKERRQ(ierr);
+    ierr = PetscContainerSetPointer(container,*bc); CHKERRQ(ierr);
+    ierr = PetscContainerSetUserDestroy(container,DestroyBedCache); CHKERRQ(ierr);
+    ierr = PetscObjectCompose((PetscObject)(info->da),"ice_bedcache",
+                              (PetscObject)container); CHKERRQ(ierr);
+    ierr = PetscContainerDestroy(&container); CHKERRQ(ierr);  // DM holds reference
+    PetscFunctionReturn(0);
+}
+
+
+/* With -ice_mask, elements far from the ice are skipped.  The mask is
+refreshed before each time step by IceMaskPreStep():  element (j,k) is
+active if it, or any of its 8 neighbors, has H > 0 at one of its nodes.  So
+it is the ice-covered region plus a one-element halo into which the margin
+can advance during the step.  Inactive elements are handled as follows:
+  * residual:  an inactive element whose four nodal H are all zero has flux
+    exactly zero, so it is skipped; the nodal check keeps the residual exact
+    even if the Newton iterate leaves the halo,
+  * Jacobian:  inactive elements contribute nothing, so rows of ice-free
+    nodes contain only the (shift) dF/dH_t diagonal.
+The mask is only attached to the DM on which TS steps.  Other DMs (e.g.
+coarse PCMG levels) have no mask and treat all elements as active.  */
+typedef struct {
+    PetscBool *active;  // active[ElementIndex(info,j,k)]
+} ActiveMask;
+
+static PetscErrorCode DestroyActiveMask(void *ctx) {
+    ActiveMask *am = (ActiveMask*)ctx;
+    PetscFree(am->active);
+    PetscFree(am);
+    return 0;
+}
+
+// get the ActiveMask attached to info->da; NULL if none (or not -ice_mask)
+PetscErrorCode GetActiveMask(DMDALocalInfo *info, AppCtx *user, ActiveMask **am) {
+    PetscErrorCode ierr;
+    PetscContainer container = NULL;
+
+    PetscFunctionBeginUser;
+    *am = NULL;
+    if (!user->mask) {
+        PetscFunctionReturn(0);
+    }
+    ierr = PetscObjectQuery((PetscObject)(info->da),"ice_activemask",
+                            (PetscObject*)&container); CHKERRQ(ierr);
+    if (container) {
+        ierr = PetscContainerGetPointer(container,(void**)am); CHKERRQ(ierr);
+    }
+    PetscFunctionReturn(0);
+}
+
+// TS pre-step hook; see comments above
+PetscErrorCode IceMaskPreStep(TS ts) {
+    PetscErrorCode ierr;
+    PetscContainer container = NULL;
+    ActiveMask     *am;
+    DM             da;
+    DMDALocalInfo  info;
+    Vec            H, Hloc;
+    PetscBool      *hasice;
+    double         **aH;
+    int            j, k, jj, kk, nact = 0;
+
+    PetscFunctionBeginUser;
+    ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+    ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+    ierr = PetscObjectQuery((PetscObject)da,"ice_activemask",
+                            (PetscObject*)&container); CHKERRQ(ierr);
+    if (container) {
+        ierr = PetscContainerGetPointer(container,(void**)&am); CHKERRQ(ierr);
+    } else {
+        ierr = PetscNew(&am); CHKERRQ(ierr);
+        ierr = PetscMalloc1((info.xm+1)*(info.ym+1),&(am->active)); CHKERRQ(ierr);
+        ierr = PetscContainerCreate(PETSC_COMM_SELF,&container); CHKERRQ(ierr);
+        ierr = PetscContainerSetPointer(container,am); CHKERRQ(ierr);
+        ierr = PetscContainerSetUserDestroy(container,DestroyActiveMask); CHKERRQ(ierr);
+        ierr = PetscObjectCompose((PetscObject)da,"ice_activemask",
+                                  (PetscObject)container); CHKERRQ(ierr);
+        ierr = PetscContainerDestroy(&container); CHKERRQ(ierr);
+    }
+
+    ierr = TSGetSolution(ts,&H); CHKERRQ(ierr);
+    ierr = DMGetLocalVector(da,&Hloc); CHKERRQ(ierr);
+    ierr = DMGlobalToLocalBegin(da,H,INSERT_VALUES,Hloc); CHKERRQ(ierr);
+    ierr = DMGlobalToLocalEnd(da,H,INSERT_VALUES,Hloc); CHKERRQ(ierr);
+    ierr = DMDAVecGetArrayRead(da,Hloc,&aH); CHKERRQ(ierr);
+    ierr = PetscMalloc1((info.xm+1)*(info.ym+1),&hasice); CHKERRQ(ierr);
+    for (k = info.ys-1; k < info.ys + info.ym; k++) {
+        for (j = info.xs-1; j < info.xs + info.xm; j++) {
+            hasice[ElementIndex(&info,j,k)] =
+                (aH[k][j] > 0.0 || aH[k][j+1] > 0.0 || aH[k+1][j+1] > 0.0 || aH[k+1][j] > 0.0)
+                ? PETSC_TRUE : PETSC_FALSE;
+        }
+    }
+    ierr = DMDAVecRestoreArrayRead(da,Hloc,&aH); CHKERRQ(ierr);
+    ierr = DMRestoreLocalVector(da,&Hloc); CHKERRQ(ierr);
+    // neighbors outside of the local patch are unknown so count as ice-covered
+    for (k = info.ys-1; k < info.ys + info.ym; k++) {
+        for (j = info.xs-1; j < info.xs + info.xm; j++) {
+            PetscBool act = PETSC_FALSE;
+            for (kk = k-1; kk <= k+1 && !act; kk++) {
+                for (jj = j-1; jj <= j+1 && !act; jj++) {
+                    if (kk < info.ys-1 || kk >= info.ys + info.ym
+                        || jj < info.xs-1 || jj >= info.xs + info.xm)
+                        act = PETSC_TRUE;
+                    else
+                        act = hasice[ElementIndex(&info,jj,kk)];
+                }
+            }
+            am->active[ElementIndex(&info,j,k)] = act;
+            if (act)
+                nact++;
+        }
+    }
+    ierr = PetscFree(hasice); CHKERRQ(ierr);
+    ierr = PetscInfo1(ts,"ice mask: %d active elements on local patch\n",nact); CHKERRQ(ierr);
+    PetscFunctionReturn(0);
+}
+
+
 /* FormIFunctionLocal  =  IFunction call-back by TS using DMDA info.
 
 Evaluates residual FF on local process patch:
@@ -744,8 +1731,9 @@ k |--------- ---------|
             j
 
 Regarding flux-component indexing on the element indexed by (j,k) node,
-the value  (aqquad[c])[k][j] for c=0,1,2,3 is an x-component at "*" and
-a y-component at "%"; note (x_j,y_k) is lower-left corner:
+the value  q[4*(j-xs+1)+c]  for c=0,1,2,3, in the buffer for element row k,
+is an x-component at "*" and a y-component at "%"; note (x_j,y_k) is
+lower-left corner:
    -------------------
   |         :         |
   |         *2        |
@@ -756,98 +1744,183 @@ a y-component at "%"; note (x_j,y_k) is lower-left corner:
   |         :         |
   @-------------------
 (j,k)
+
+The residual at nodes in row k only needs fluxes from element rows k-1 and
+k.  Thus fluxes are computed one element row at a time into a rolling
+buffer of two rows, and the residual for node row k is accumulated as soon
+as element row k is done.  The working set is O(xm), not O(xm*ym).  The
+buffer is allocated once per DMDA; see BedCache.
 */
-PetscErrorCode FormIFunctionLocal(DMDALocalInfo *info, double t,
-                                  double **aH, double **aHdot, double **FF,
-                                  AppCtx *user) {
+
+// compute fluxes q at c = 0,1,2,3 points in elements (j,k) for
+// j = xs-1,...,xs+xm-1, i.e. one row of elements including ghosts
+static PetscErrorCode FluxElementRow(DMDALocalInfo *info, int k, double **aH,
+                                     BedCache *bc, ActiveMask *am, double *q,
+                                     AppCtx *user) {
   PetscErrorCode  ierr;
   const double    dx = user->L / (double)(info->mx),
                   dy = user->L / (double)(info->my);
-  // coefficients of quadrature evaluations along the boundary of the control volume in M*
-  const double    coeff[8] = {dy/2, dx/2, dx/2, -dy/2, -dy/2, -dx/2, -dx/2, dy/2};
   const PetscBool upwind = (user->lambda > 0.0);
   const double    upmin = (1.0 - user->lambda) * 0.5,
                   upmax = (1.0 + user->lambda) * 0.5;
-  int             c, j, k, s;
-  double          H, Hup, lxup, lyup, **aqquad[4], **ab,
-                  DSIA_ckj, qSIA_ckj, V_ckj;
+  int             c, j;
+  double          H, Hup, lxup, lyup, DSIA_ckj, qSIA_ckj, V_ckj;
   Grad            gH, gb;
-  Vec             qquad[4], b;
 
   PetscFunctionBeginUser;
-  user->locmaxD = 0.0;
-  user->locmaxV = 0.0;
-  ierr = DMGetLocalVector(info->da, &b); CHKERRQ(ierr);
-  if (user->verif > 0) {
-      ierr = VecSet(b,0.0); CHKERRQ(ierr);
-      ierr = DMDAVecGetArray(info->da,b,&ab); CHKERRQ(ierr);
-  } else {
-      ierr = DMDAVecGetArray(info->da,b,&ab); CHKERRQ(ierr);
-      ierr = FormBedLocal(info,1,ab,user); CHKERRQ(ierr);  // get stencil width
-  }
-  for (c = 0; c < 4; c++) {
-      ierr = DMGetLocalVector(info->da, &(qquad[c])); CHKERRQ(ierr);
-      ierr = DMDAVecGetArray(info->da,qquad[c],&(aqquad[c])); CHKERRQ(ierr);
-  }
-
-  // loop over locally-owned elements, including ghosts, to get fluxes q at
-  // c = 0,1,2,3 points in element;  note start at (xs-1,ys-1)
-  for (k = info->ys-1; k < info->ys + info->ym; k++) {
-      for (j = info->xs-1; j < info->xs + info->xm; j++) {
-          for (c=0; c<4; c++) {
-              H  = fieldatptArray(j,k,locx[c],locy[c],aH);
-              gH = gradfatptArray(j,k,locx[c],locy[c],dx,dy,aH);
-              gb = gradfatptArray(j,k,locx[c],locy[c],dx,dy,ab);
-              if (upwind) {
-                  if (xdire[c] == PETSC_TRUE) {
-                      lxup = (gb.x <= 0.0) ? upmin : upmax;
-                      lyup = locy[c];
-                  } else {
-                      lxup = locx[c];
-                      lyup = (gb.y <= 0.0) ? upmin : upmax;
-                  }
-                  Hup = fieldatptArray(j,k,lxup,lyup,aH);
-              } else
-                  Hup = H;
-              ierr = SIAflux(gH,gb,H,Hup,xdire[c],
-                             &DSIA_ckj,&qSIA_ckj,user); CHKERRQ(ierr);
-              ierr = slidingvelocity(gb,xdire[c],&V_ckj,user); CHKERRQ(ierr);
-              aqquad[c][k][j] = qSIA_ckj + V_ckj * Hup;
-              if (user->dtlimits) {
-                  user->locmaxD = PetscMax(user->locmaxD,DSIA_ckj);
-                  user->locmaxV = PetscMax(user->locmaxV,PetscAbs(V_ckj));
+  for (j = info->xs-1; j < info->xs + info->xm; j++) {
+      if (am && !am->active[ElementIndex(info,j,k)]
+             && aH[k][j] == 0.0 && aH[k][j+1] == 0.0
+             && aH[k+1][j+1] == 0.0 && aH[k+1][j] == 0.0) {
+          for (c=0; c<4; c++)
+              q[4*(j-info->xs+1)+c] = 0.0;
+          continue;
+      }
+      for (c=0; c<4; c++) {
+          H  = fieldatptArray(j,k,locx[c],locy[c],aH);
+          gH = gradfatptArray(j,k,locx[c],locy[c],dx,dy,aH);
+          gb = bc->gb[BedGradIndex(info,j,k,c)];
+          if (upwind) {
+              if (xdire[c] == PETSC_TRUE) {
+                  lxup = (gb.x <= 0.0) ? upmin : upmax;
+                  lyup = locy[c];
+              } else {
+                  lxup = locx[c];
+                  lyup = (gb.y <= 0.0) ? upmin : upmax;
               }
+              Hup = fieldatptArray(j,k,lxup,lyup,aH);
+          } else
+              Hup = H;
+          ierr = SIAflux(gH,gb,H,Hup,xdire[c],
+                         &DSIA_ckj,&qSIA_ckj,user); CHKERRQ(ierr);
+          ierr = slidingvelocity(gb,xdire[c],&V_ckj,user); CHKERRQ(ierr);
+          q[4*(j-info->xs+1)+c] = qSIA_ckj + V_ckj * Hup;
+          // explicit schemes need these for their step; see ExplicitRate()
+          if (user->dtlimits || user->explicitscheme != EXPLICIT_NONE) {
+              user->locmaxD = PetscMax(user->locmaxD,DSIA_ckj);
+              user->locmaxV = PetscMax(user->locmaxV,PetscAbs(V_ckj));
           }
       }
   }
+  PetscFunctionReturn(0);
+}
 
-  // loop over nodes, not including ghosts, to get function F(t,H,H') from quadature over
-  // s = 0,1,...,7 points on boundary of control volume (rectangle) around node
+PetscErrorCode FormIFunctionLocal(DMDALocalInfo *info, double t,
+                                  double **aH, double **aHdot, double **FF,
+                                  AppCtx *user) {
+  PetscErrorCode  ierr;
+  const double    dx = user->L / (double)(info->mx),
+                  dy = user->L / (double)(info->my);
+  // coefficients of quadrature evaluations along the boundary of the control volume in M*
+  const double    coeff[8] = {dy/2, dx/2, dx/2, -dy/2, -dy/2, -dx/2, -dx/2, dy/2};
+  int             j, k, s;
+  double          *qbuf, *qrow[2], *qe;
+  BedCache        *bc;
+  ActiveMask      *am;
+
+  PetscFunctionBeginUser;
+  user->locmaxD = 0.0;
+  user->locmaxV = 0.0;
+  ierr = GetBedCache(info,user,&bc); CHKERRQ(ierr);
+  ierr = GetActiveMask(info,user,&am); CHKERRQ(ierr);
+  qbuf = bc->qbuf;
+
+  // element row ys-1 (ghosts) seeds the rolling buffer
+  ierr = FluxElementRow(info,info->ys-1,aH,bc,am,qbuf,user); CHKERRQ(ierr);
   for (k=info->ys; k<info->ys+info->ym; k++) {
+      // qrow[1] is element row k, qrow[0] is element row k-1
+      qrow[0] = qbuf + 4*(info->xm+1) * ((k - info->ys) % 2);
+      qrow[1] = qbuf + 4*(info->xm+1) * ((k - info->ys + 1) % 2);
+      ierr = FluxElementRow(info,k,aH,bc,am,qrow[1],user); CHKERRQ(ierr);
+      // loop over nodes in row, not including ghosts, to get function F(t,H,H')
+      // from quadature over s = 0,1,...,7 points on boundary of control
+      // volume (rectangle) around node
       for (j=info->xs; j<info->xs+info->xm; j++) {
           FF[k][j] = aHdot[k][j];
           // now add integral over control volume boundary using two
           // quadrature points on each side
-          for (s=0; s<8; s++)
-              FF[k][j] += coeff[s] * aqquad[ce[s]][k+ke[s]][j+je[s]] / (dx * dy);
+          for (s=0; s<8; s++) {
+              qe = qrow[1+ke[s]] + 4*(j+je[s]-info->xs+1);
+              FF[k][j] += coeff[s] * qe[ce[s]] / (dx * dy);
+          }
       }
   }
+  PetscFunctionReturn(0);
+}
 
-  for (c = 0; c < 4; c++) {
-      ierr = DMDAVecRestoreArray(info->da,qquad[c],&(aqquad[c])); CHKERRQ(ierr);
-      ierr = DMRestoreLocalVector(info->da, &(qquad[c])); CHKERRQ(ierr);
+
+/* Derivatives DqDl[c][l] of the fluxes at points c=0,1,2,3 in element (j,k)
+with respect to the values of H at its nodes l=0,1,2,3; the nodes are
+(j,k), (j+1,k), (j+1,k+1), (j,k+1) in that order.  */
+static PetscErrorCode ElementFluxDerivatives(DMDALocalInfo *info, int j, int k,
+                                             double **aH, BedCache *bc,
+                                             double DqDl[4][4], AppCtx *user) {
+  PetscErrorCode  ierr;
+  const double    dx = user->L / (double)(info->mx),
+                  dy = user->L / (double)(info->my);
+  const PetscBool upwind = (user->lambda > 0.0);
+  const double    upmin = (1.0 - user->lambda) * 0.5,
+                  upmax = (1.0 + user->lambda) * 0.5;
+  int             c, l;
+  double          H, Hup, DqSIADl_clkj, V_ckj;
+  Grad            gH, gb;
+
+  PetscFunctionBeginUser;
+  for (c=0; c<4; c++) {
+      double lxup = locx[c], lyup = locy[c];
+      H  = fieldatptArray(j,k,locx[c],locy[c],aH);
+      gH = gradfatptArray(j,k,locx[c],locy[c],dx,dy,aH);
+      gb = bc->gb[BedGradIndex(info,j,k,c)];
+      if (upwind) {
+          if (xdire[c] == PETSC_TRUE) {
+              lxup = (gb.x <= 0.0) ? upmin : upmax;
+              lyup = locy[c];
+          } else {
+              lxup = locx[c];
+              lyup = (gb.y <= 0.0) ? upmin : upmax;
+          }
+          Hup = fieldatptArray(j,k,lxup,lyup,aH);
+      } else {
+          Hup = H;
+      }
+      ierr = slidingvelocity(gb,xdire[c],&V_ckj,user); CHKERRQ(ierr);
+      for (l=0; l<4; l++) {
+          Grad   dgHdl;
+          double dHdl, dHupdl;
+          dgHdl  = dgradfatpt(l,locx[c],locy[c],dx,dy);
+          dHdl   = dfieldatpt(l,locx[c],locy[c]);
+          dHupdl = (upwind) ? dfieldatpt(l,lxup,lyup) : dHdl;
+          DqSIADl_clkj = DSIAfluxDl(gH,gb,dgHdl,H,dHdl,Hup,dHupdl,xdire[c],user);
+          DqDl[c][l] = DqSIADl_clkj + V_ckj * dHupdl;
+      }
   }
-  ierr = DMDAVecRestoreArray(info->da,b,&ab); CHKERRQ(ierr);
-  ierr = DMRestoreLocalVector(info->da, &b); CHKERRQ(ierr);
   PetscFunctionReturn(0);
 }
 
-
 // use j,k for x,y directions in loops and MatSetValuesStencil
 typedef struct {
   PetscInt foo,k,j,bar;
 } MyStencil;
 
+// offsets of node l=0,1,2,3 of element (j,k) relative to (j,k)
+static const int  djfroml[4] = { 0,  1,  1,  0},
+                  dkfroml[4] = { 0,  0,  1,  1};
+
+static PetscErrorCode FinishIJacobian(Mat J, Mat P) {
+  PetscErrorCode  ierr;
+  PetscFunctionBeginUser;
+  ierr = MatAssemblyBegin(P,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
+  ierr = MatAssemblyEnd(P,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
+  if (J != P) {
+    ierr = MatAssemblyBegin(J,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
+    ierr = MatAssemblyEnd(J,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
+  }
+  //ierr = MatView(J,PETSC_VIEWER_STDOUT_WORLD); CHKERRQ(ierr);
+  PetscFunctionReturn(0);
+}
+
+/* Node-major assembly (-ice_jac_assembly node; the default):  store all flux
+derivatives on the local patch, then generate one 33-entry row per node.  */
 PetscErrorCode FormIJacobianLocal(DMDALocalInfo *info, double t,
                                   double **aH, double **aHdot, double shift,
                                   Mat J, Mat P, AppCtx *user) {
@@ -855,26 +1928,18 @@ PetscErrorCode FormIJacobianLocal(DMDALocalInfo *info, double t,
   const double    dx = user->L / (double)(info->mx),
                   dy = user->L / (double)(info->my);
   const double    coeff[8] = {dy/2, dx/2, dx/2, -dy/2, -dy/2, -dx/2, -dx/2, dy/2};
-  const PetscBool upwind = (user->lambda > 0.0);
-  const double    upmin = (1.0 - user->lambda) * 0.5,
-                  upmax = (1.0 + user->lambda) * 0.5;
   int             j, k, c, l, s, u, v;
-  double          H, Hup, **aDqDlquad[16], **ab, val[33], DqSIADl_clkj, V_ckj;
-  Grad            gH, gb;
-  Vec             DqDlquad[16], b;
+  double          **aDqDlquad[16], val[33], DqDl[4][4];
+  Vec             DqDlquad[16];
+  BedCache        *bc;
+  ActiveMask      *am;
   MyStencil       col[33],row;
 
   PetscFunctionBeginUser;
   ierr = MatZeroEntries(P); CHKERRQ(ierr);  // because using ADD_VALUES below
 
-  ierr = DMGetLocalVector(info->da, &b); CHKERRQ(ierr);
-  if (user->verif > 0) {
-      ierr = VecSet(b,0.0); CHKERRQ(ierr);
-      ierr = DMDAVecGetArray(info->da,b,&ab); CHKERRQ(ierr);
-  } else {
-      ierr = DMDAVecGetArray(info->da,b,&ab); CHKERRQ(ierr);
-      ierr = FormBedLocal(info,1,ab,user); CHKERRQ(ierr);  // get stencil width
-  }
+  ierr = GetBedCache(info,user,&bc); CHKERRQ(ierr);
+  ierr = GetActiveMask(info,user,&am); CHKERRQ(ierr);
   for (c = 0; c < 16; c++) {
       ierr = DMGetLocalVector(info->da, &(DqDlquad[c])); CHKERRQ(ierr);
       ierr = DMDAVecGetArray(info->da,DqDlquad[c],&(aDqDlquad[c])); CHKERRQ(ierr);
@@ -884,33 +1949,15 @@ PetscErrorCode FormIJacobianLocal(DMDALocalInfo *info, double t,
   // l=0,1,2,3 at c=0,1,2,3 points in element;  note start at (xs-1,ys-1)
   for (k = info->ys-1; k < info->ys + info->ym; k++) {
       for (j = info->xs-1; j < info->xs + info->xm; j++) {
+          if (am && !am->active[ElementIndex(info,j,k)]) {
+              for (c=0; c<16; c++)
+                  aDqDlquad[c][k][j] = 0.0;
+              continue;
+          }
+          ierr = ElementFluxDerivatives(info,j,k,aH,bc,DqDl,user); CHKERRQ(ierr);
           for (c=0; c<4; c++) {
-              double lxup = locx[c], lyup = locy[c];
-              H  = fieldatptArray(j,k,locx[c],locy[c],aH);
-              gH = gradfatptArray(j,k,locx[c],locy[c],dx,dy,aH);
-              gb = gradfatptArray(j,k,locx[c],locy[c],dx,dy,ab);
-              if (upwind) {
-                  if (xdire[c] == PETSC_TRUE) {
-                      lxup = (gb.x <= 0.0) ? upmin : upmax;
-                      lyup = locy[c];
-                  } else {
-                      lxup = locx[c];
-                      lyup = (gb.y <= 0.0) ? upmin : upmax;
-                  }
-                  Hup = fieldatptArray(j,k,lxup,lyup,aH);
-              } else {
-                  Hup = H;
-              }
-              ierr = slidingvelocity(gb,xdire[c],&V_ckj,user); CHKERRQ(ierr);
-              for (l=0; l<4; l++) {
-                  Grad   dgHdl;
-                  double dHdl, dHupdl;
-                  dgHdl  = dgradfatpt(l,locx[c],locy[c],dx,dy);
-                  dHdl   = dfieldatpt(l,locx[c],locy[c]);
-                  dHupdl = (upwind) ? dfieldatpt(l,lxup,lyup) : dHdl;
-                  DqSIADl_clkj = DSIAfluxDl(gH,gb,dgHdl,H,dHdl,Hup,dHupdl,xdire[c],user);
-                  aDqDlquad[4*c+l][k][j] = DqSIADl_clkj + V_ckj * dHupdl;
-              }
+              for (l=0; l<4; l++)
+                  aDqDlquad[4*c+l][k][j] = DqDl[c][l];
           }
       }
   }
@@ -925,8 +1972,6 @@ PetscErrorCode FormIJacobianLocal(DMDALocalInfo *info, double t,
               u = j + je[s];
               v = k + ke[s];
               for (l=0; l<4; l++) {
-                  const int djfroml[4] = { 0,  1,  1,  0},
-                            dkfroml[4] = { 0,  0,  1,  1};
                   col[4*s+l].j = u + djfroml[l];
                   col[4*s+l].k = v + dkfroml[l];
                   val[4*s+l]   = coeff[s] * aDqDlquad[4*ce[s]+l][v][u] / (dx * dy);
@@ -944,16 +1989,64 @@ PetscErrorCode FormIJacobianLocal(DMDALocalInfo *info, double t,
       ierr = DMDAVecRestoreArray(info->da,DqDlquad[c],&(aDqDlquad[c])); CHKERRQ(ierr);
       ierr = DMRestoreLocalVector(info->da, &(DqDlquad[c])); CHKERRQ(ierr);
   }
-  ierr = DMDAVecRestoreArray(info->da,b,&ab); CHKERRQ(ierr);
-  ierr = DMRestoreLocalVector(info->da, &b); CHKERRQ(ierr);
 
-  ierr = MatAssemblyBegin(P,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
-  ierr = MatAssemblyEnd(P,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
-  if (J != P) {
-    ierr = MatAssemblyBegin(J,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
-    ierr = MatAssemblyEnd(J,MAT_FINAL_ASSEMBLY);CHKERRQ(ierr);
+  ierr = FinishIJacobian(J,P); CHKERRQ(ierr);
+  PetscFunctionReturn(0);
+}
+
+/* Element-major assembly (-ice_jac_assembly element):  no work Vecs.  Of the
+8 quadrature points s=0,...,7 on the boundary of the control volume around a
+node, the two points s=2l,2l+1 lie in the element for which that node is
+node l.  So element (j,k) contributes a 4x4 block
+    Ke[l][m] = sum_{s=2l,2l+1} coeff[s] DqDl[ce[s]][m] / (dx dy)
+which is added directly into the preallocated AIJ matrix using local
+(ghosted) indices.  Rows of nodes owned by other processes get index -1,
+which MatSetValuesLocal() ignores, so no values go off-process.  */
+PetscErrorCode FormIJacobianElementLocal(DMDALocalInfo *info, double t,
+                                  double **aH, double **aHdot, double shift,
+                                  Mat J, Mat P, AppCtx *user) {
+  PetscErrorCode  ierr;
+  const double    dx = user->L / (double)(info->mx),
+                  dy = user->L / (double)(info->my);
+  const double    coeff[8] = {dy/2, dx/2, dx/2, -dy/2, -dy/2, -dx/2, -dx/2, dy/2};
+  int             j, k, l, m, s, jj, kk, row[4], col[4];
+  double          DqDl[4][4], Ke[16];
+  BedCache        *bc;
+  ActiveMask      *am;
+
+  PetscFunctionBeginUser;
+  ierr = MatZeroEntries(P); CHKERRQ(ierr);  // because using ADD_VALUES below
+  ierr = MatSetOption(P,MAT_NO_OFF_PROC_ENTRIES,PETSC_TRUE); CHKERRQ(ierr);
+  ierr = GetBedCache(info,user,&bc); CHKERRQ(ierr);
+  ierr = GetActiveMask(info,user,&am); CHKERRQ(ierr);
+
+  // loop over locally-owned elements, including ghosts; note start at (xs-1,ys-1)
+  for (k = info->ys-1; k < info->ys + info->ym; k++) {
+      for (j = info->xs-1; j < info->xs + info->xm; j++) {
+          if (am && !am->active[ElementIndex(info,j,k)])
+              continue;
+          ierr = ElementFluxDerivatives(info,j,k,aH,bc,DqDl,user); CHKERRQ(ierr);
+          for (l=0; l<4; l++) {
+              jj = j + djfroml[l];
+              kk = k + dkfroml[l];
+              col[l] = (kk - info->gys) * info->gxm + (jj - info->gxs);
+              if (   jj >= info->xs && jj < info->xs + info->xm
+                  && kk >= info->ys && kk < info->ys + info->ym)
+                  row[l] = col[l];
+              else
+                  row[l] = -1;
+              for (m=0; m<4; m++) {
+                  Ke[4*l+m] = 0.0;
+                  for (s=2*l; s<2*l+2; s++)
+                      Ke[4*l+m] += coeff[s] * DqDl[ce[s]][m] / (dx * dy);
+              }
+          }
+          ierr = MatSetValuesLocal(P,4,row,4,col,Ke,ADD_VALUES); CHKERRQ(ierr);
+      }
   }
-  //ierr = MatView(J,PETSC_VIEWER_STDOUT_WORLD); CHKERRQ(ierr);
+
+  ierr = FinishIJacobian(J,P); CHKERRQ(ierr);
+  ierr = MatShift(P,shift); CHKERRQ(ierr);  // (shift) dF/dH_t
   PetscFunctionReturn(0);
 }
 
@@ -964,13 +2057,12 @@ PetscErrorCode FormRHSFunctionLocal(DMDALocalInfo *info, double t, double **aH,
   const double    dx = user->L / (double)(info->mx),
                   dy = user->L / (double)(info->my);
   int             j, k;
-  Vec             b;
+  BedCache        *bc;
   double          **ab, y, x, m;
 
   PetscFunctionBeginUser;
-  ierr = DMGetLocalVector(info->da, &b); CHKERRQ(ierr);
-  ierr = DMDAVecGetArray(info->da,b,&ab); CHKERRQ(ierr);
-  ierr = FormBedLocal(info,0,ab,user); CHKERRQ(ierr);  // stencil width NOT needed
+  ierr = GetBedCache(info,user,&bc); CHKERRQ(ierr);
+  ierr = DMDAVecGetArrayRead(info->da,bc->b,&ab); CHKERRQ(ierr);
   for (k=info->ys; k<info->ys+info->ym; k++) {
       y = k * dy;
       for (j=info->xs; j<info->xs+info->xm; j++) {
@@ -985,8 +2077,119 @@ PetscErrorCode FormRHSFunctionLocal(DMDALocalInfo *info, double t, double **aH,
           GG[k][j] = m;
       }
   }
-  ierr = DMDAVecRestoreArray(info->da,b,&ab); CHKERRQ(ierr);
-  ierr = DMRestoreLocalVector(info->da, &b); CHKERRQ(ierr);
+  ierr = DMDAVecRestoreArrayRead(info->da,bc->b,&ab); CHKERRQ(ierr);
   PetscFunctionReturn(0);
 }
 
+
+
+/* Explicit time stepping, with no Jacobian assembly and no VI solve.  The
+tendency is
+    dH/dt = R(H) = G(H) - F(H, 0)
+where F is the IFunction with Hdot = 0, i.e. the flux divergence, and G is the
+RHSFunction (the CMB).  Each step uses dt = explicitcfl * min(dtD,dtCFL), from
+the same diffusivity and velocity maxima as ExplicitLimitsMonitor(), but no
+more than -ice_dtinit.  Each (stage) update is projected onto H >= 0.  The
+SSP2 scheme is Heun's method written as a convex combination of Euler steps,
+so the projection is applied at each stage.  */
+static PetscErrorCode ExplicitRate(DM da, double t, Vec H, Vec Hloc, Vec zero,
+                                   Vec F, Vec R, double *dtlim, AppCtx *user) {
+    PetscErrorCode ierr;
+    DMDALocalInfo  info;
+    MPI_Comm       com;
+    double         **aH, **azero, **aF, **aR, loc[2], glob[2], dd;
+
+    PetscFunctionBeginUser;
+    ierr = DMDAGetLocalInfo(da,&info); CHKERRQ(ierr);
+    ierr = DMGlobalToLocalBegin(da,H,INSERT_VALUES,Hloc); CHKERRQ(ierr);
+    ierr = DMGlobalToLocalEnd(da,H,INSERT_VALUES,Hloc); CHKERRQ(ierr);
+    ierr = DMDAVecGetArray(da,Hloc,&aH); CHKERRQ(ierr);
+    ierr = DMDAVecGetArray(da,zero,&azero); CHKERRQ(ierr);
+    ierr = DMDAVecGetArray(da,F,&aF); CHKERRQ(ierr);
+    ierr = DMDAVecGetArray(da,R,&aR); CHKERRQ(ierr);
+    ierr = FormIFunctionLocal(&info,t,aH,azero,aF,user); CHKERRQ(ierr);
+    ierr = FormRHSFunctionLocal(&info,t,aH,aR,user); CHKERRQ(ierr);
+    ierr = DMDAVecRestoreArray(da,R,&aR); CHKERRQ(ierr);
+    ierr = DMDAVecRestoreArray(da,F,&aF); CHKERRQ(ierr);
+    ierr = DMDAVecRestoreArray(da,zero,&azero); CHKERRQ(ierr);
+    ierr = DMDAVecRestoreArray(da,Hloc,&aH); CHKERRQ(ierr);
+    ierr = VecAXPY(R,-1.0,F); CHKERRQ(ierr);
+
+    if (dtlim) {
+        // FormIFunctionLocal() has set locmaxD, locmaxV
+        loc[0] = user->locmaxD;
+        loc[1] = user->locmaxV;
+        ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+        ierr = MPI_Allreduce(loc,glob,2,MPI_DOUBLE,MPI_MAX,com); CHKERRQ(ierr);
+        dd = PetscMin(user->L / (double)(info.mx), user->L / (double)(info.my));
+        *dtlim = PETSC_INFINITY;
+        if (glob[0] > 0.0)
+            *dtlim = PetscMin(*dtlim, dd * dd / (4.0 * glob[0]));
+        if (glob[1] > 0.0)
+            *dtlim = PetscMin(*dtlim, dd / glob[1]);
+    }
+    PetscFunctionReturn(0);
+}
+
+// take explicit steps on H from the current TS time to te; leaves the TS at te
+PetscErrorCode ExplicitSolve(TS ts, Vec H, double te, AppCtx *user) {
+    PetscErrorCode ierr;
+    DM             da;
+    MPI_Comm       com;
+    Vec            Hloc, zero, F, R, H1;
+    double         t, dt, dtlim;
+    int            step;
+
+    PetscFunctionBeginUser;
+    ierr = TSGetDM(ts,&da); CHKERRQ(ierr);
+    ierr = TSGetTime(ts,&t); CHKERRQ(ierr);
+    ierr = TSGetStepNumber(ts,&step); CHKERRQ(ierr);
+    ierr = TSSetSolution(ts,H); CHKERRQ(ierr);
+    ierr = DMCreateLocalVector(da,&Hloc); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&zero); CHKERRQ(ierr);
+    ierr = VecSet(zero,0.0); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&F); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&R); CHKERRQ(ierr);
+    ierr = VecDuplicate(H,&H1); CHKERRQ(ierr);
+    ierr = PetscObjectGetComm((PetscObject)da,&com); CHKERRQ(ierr);
+    ierr = PetscPrintf(com,
+        "%sexplicit %s steps from %.3f a to %.3f a ...\n",user->label,
+        ExplicitTypes[user->explicitscheme],t/user->secpera,te/user->secpera); CHKERRQ(ierr);
+
+    while (t < te) {
+        // as in TSSolve(), monitors see the state at the start of each step
+        ierr = TSMonitor(ts,step,t,H); CHKERRQ(ierr);
+        if (user->mask) {
+            ierr = IceMaskPreStep(ts); CHKERRQ(ierr);
+        }
+        ierr = ExplicitRate(da,t,H,Hloc,zero,F,R,&dtlim,user); CHKERRQ(ierr);
+        dt = PetscMin(user->explicitcfl * dtlim, user->dtinit);
+        dt = PetscMin(dt, te - t);
+        // Euler step (also first stage of SSP2):  H1 = max(0, H + dt R(H))
+        ierr = VecWAXPY(H1,dt,R,H); CHKERRQ(ierr);
+        ierr = VecPointwiseMax(H1,H1,zero); CHKERRQ(ierr);
+        if (user->explicitscheme == EXPLICIT_SSP2) {
+            // H = max(0, (1/2) H + (1/2) (H1 + dt R(H1)))
+            ierr = ExplicitRate(da,t+dt,H1,Hloc,zero,F,R,NULL,user); CHKERRQ(ierr);
+            ierr = VecAXPY(H1,dt,R); CHKERRQ(ierr);
+            ierr = VecAXPBY(H,0.5,0.5,H1); CHKERRQ(ierr);
+            ierr = VecPointwiseMax(H,H,zero); CHKERRQ(ierr);
+        } else {
+            ierr = VecCopy(H1,H); CHKERRQ(ierr);
+        }
+        t += dt;
+        step++;
+        ierr = TSSetTime(ts,t); CHKERRQ(ierr);
+        ierr = TSSetStepNumber(ts,step); CHKERRQ(ierr);
+    }
+    // if TSSolve() follows then it monitors the switch step, so only once
+    if (t >= user->tf) {
+        ierr = TSMonitor(ts,step,t,H); CHKERRQ(ierr);
+    }
+
+    // implicit TS steps, if any, restart from the initial time step
+    ierr = TSSetTimeStep(ts,user->dtinit); CHKERRQ(ierr);
+    VecDestroy(&Hloc);  VecDestroy(&zero);  VecDestroy(&F);
+    VecDestroy(&R);  VecDestroy(&H1);
+    PetscFunctionReturn(0);
+}
@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+
+# Weak and strong scaling benchmark for ../../ice on one machine, replacing
+# hand-copying of "time" output from the slurm scripts in ../weak and ../pc.
+# Each run adds -log_view; the total time and the time (max over processes)
+# and count of these events are parsed from its output:
+#   SNESFunctionEval, SNESJacobianEval, KSPSolve, PCSetUp, PCApply, TSStep
+# Results, with parallel efficiency, go to a JSON file.  Examples:
+#   ./icebench.py --mode strong --levels 5 --nps 1,2,4 --pcs gamg,mg
+#   ./icebench.py --mode weak --levels 4,5,6 --nps 1,4,16 --pcs mg
+# In weak mode each refinement level is paired with a process count; since
+# -da_refine increases the number of points by four, so should the process
+# count.  In strong mode every level is run on every process count.
+# Efficiency is relative to the first process count:
+#   strong:  E = (T_1 np_1) / (T_k np_k)
+#   weak:    E = T_1 / T_k
+
+from __future__ import print_function
+import argparse
+import json
+import re
+import subprocess
+import sys
+import time
+
+# named preconditioner choices; -pc_mg_levels depends on refinement level
+PCS = {'gamg':   '-pc_type gamg -pc_gamg_agg_nsmooths 0',
+       'mg':     '-pc_type mg -pc_mg_levels %(mglev)d',
+       'asmilu': '-pc_type asm -sub_pc_type ilu',
+       'asmgamg':'-pc_type asm -sub_pc_type gamg'}
+
+EVENTS = ['SNESFunctionEval', 'SNESJacobianEval', 'KSPSolve',
+          'PCSetUp', 'PCApply', 'TSStep']
+
+# the base run is the Halfar verification case from ../weak and ../pc
+BASIC = '-ice_verif 2 -ts_type beuler -ice_tf 10.0 -ice_dtinit 10.0 -ice_monitor 0'
+
+def parselogview(out):
+    '''From -log_view output, get total time and {event: [count, time]}.'''
+    result = {'total': None, 'events': {}}
+    m = re.search(r'^Time \(sec\):\s+(\S+)', out, re.MULTILINE)
+    if m:
+        result['total'] = float(m.group(1))
+    for ev in EVENTS:
+        # columns:  Event  Count-Max Ratio  Time-Max Ratio ...
+        m = re.search(r'^%s\s+(\d+)\s+\S+\s+(\S+)' % ev, out, re.MULTILINE)
+        if m:
+            result['events'][ev] = {'count': int(m.group(1)),
+                                    'time': float(m.group(2))}
+    return result
+
+def run(args, lev, np, pc):
+    opts = '%s -da_refine %d %s %s -log_view' \
+           % (BASIC, lev, PCS[pc] % {'mglev': max(lev-1,1)}, args.extra)
+    cmd = '%s -n %d %s %s' % (args.mpiexec, np, args.ice, opts)
+    print('running: ' + cmd)
+    sys.stdout.flush()
+    wall = time.time()
+    proc = subprocess.Popen(cmd.split(), stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    out, _ = proc.communicate()
+    wall = time.time() - wall
+    rec = {'level': lev, 'np': np, 'pc': pc, 'command': cmd,
+           'returncode': proc.returncode, 'wall': wall}
+    rec.update(parselogview(out))
+    if proc.returncode != 0 or rec['total'] is None:
+        print('  FAILED (return code %d); last output:' % proc.returncode)
+        print('\n'.join(out.splitlines()[-10:]))
+    else:
+        print('  total %.3f s, KSPSolve %.3f s'
+              % (rec['total'], rec['events'].get('KSPSolve', {}).get('time', 0.0)))
+    return rec
+
+def efficiency(mode, recs):
+    '''Add 'efficiency' to each record, relative to the first in the list.'''
+    ok = [r for r in recs if r['total'] is not None]
+    if len(ok) == 0:
+        return
+    base = ok[0]
+    for r in ok:
+        if mode == 'strong':
+            r['efficiency'] = (base['total'] * base['np']) / (r['total'] * r['np'])
+        else:
+            r['efficiency'] = base['total'] / r['total']
+
+def intlist(s):
+    return [int(x) for x in s.split(',')]
+
+parser = argparse.ArgumentParser(description='weak/strong scaling study of ice')
+parser.add_argument('--mode', choices=['weak','strong'], default='strong')
+parser.add_argument('--levels', type=intlist, default=[4],
+                    help='comma-separated -da_refine levels')
+parser.add_argument('--nps', type=intlist, default=[1,2,4],
+                    help='comma-separated process counts')
+parser.add_argument('--pcs', default='gamg,mg',
+                    help='comma-separated from: ' + ','.join(sorted(PCS.keys())))
+parser.add_argument('--extra', default='', help='more options to ice')
+parser.add_argument('--ice', default='../../ice', help='path to executable')
+parser.add_argument('--mpiexec', default='mpiexec')
+parser.add_argument('-o', '--output', default='icebench.json')
+args = parser.parse_args()
+
+pcs = args.pcs.split(',')
+for pc in pcs:
+    if pc not in PCS:
+        parser.error('unknown preconditioner %s' % pc)
+if args.mode == 'weak' and len(args.levels) != len(args.nps):
+    parser.error('weak mode needs as many levels as process counts')
+
+results = []
+for pc in pcs:
+    if args.mode == 'weak':
+        recs = [run(args, lev, np, pc) for lev, np in zip(args.levels, args.nps)]
+        efficiency('weak', recs)
+        results += recs
+    else:
+        for lev in args.levels:
+            recs = [run(args, lev, np, pc) for np in args.nps]
+            efficiency('strong', recs)
+            results += recs
+
+with open(args.output, 'w') as f:
+    json.dump({'mode': args.mode, 'basic': BASIC, 'runs': results}, f, indent=2)
+print('results written to %s' % args.output)
+
+print('%-8s %5s %4s %10s %10s %10s %10s %6s'
+      % ('pc', 'level', 'np', 'total', 'FuncEval', 'JacEval', 'KSPSolve', 'eff'))
+for r in results:
+    if r['total'] is None:
+        continue
+    ev = r['events']
+    print('%-8s %5d %4d %10.3f %10.3f %10.3f %10.3f %6.3f'
+          % (r['pc'], r['level'], r['np'], r['total'],
+             ev.get('SNESFunctionEval', {}).get('time', 0.0),
+             ev.get('SNESJacobianEval', {}).get('time', 0.0),
+             ev.get('KSPSolve', {}).get('time', 0.0),
+             r.get('efficiency', 0.0)))
@@ -29,6 +29,15 @@ double gN_lin(double x, double y) {
     return 0.0;
 }
 
+// derivatives with respect to u, for Newton's method:
+double dadu_lin(double u, double x, double y) {
+    return 0.0;
+}
+
+double dfdu_lin(double u, double x, double y) {
+    return 0.0;
+}
+
 
 // -----------------------------------------------------------------------------
 // CASE 1
@@ -45,6 +54,15 @@ double f_nonlin(double u, double x, double y) {
     return - 2.0 * u * dudy * dudy + (1.0 + u * u) * (2.0 + 3.0 * y * y);
 }
 
+double dadu_nonlin(double u, double x, double y) {
+    return 2.0 * u;
+}
+
+double dfdu_nonlin(double u, double x, double y) {
+    const double dudy = - 2.0 * y - y * y * y;
+    return - 2.0 * dudy * dudy + 2.0 * u * (2.0 + 3.0 * y * y);
+}
+
 // uexact_nonlin = uexact_lin
 // gD_nonlin = gD_lin
 // gN_nonlin = gN_lin
@@ -89,6 +107,8 @@ double uexact_square(double x, double y) {
     return (x2 - x2 * x2) * (y2 * y2 - y2);
 }
 
+// a_square(), f_square() do not depend on u, so use dadu_lin(), dfdu_lin()
+
 // just evaluate exact u on boundary point:
 double gD_square(double x, double y) {
     return uexact_square(x,y);
@@ -114,5 +134,7 @@ double gD_koch(double x, double y) {
     return 0.0;
 }
 
+// a_koch(), f_koch() do not depend on u, so use dadu_lin(), dfdu_lin()
+
 #endif
 
@@ -1,7 +1,43 @@
 #include <petsc.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../quadrature.h"
 #include "um.h"
 
+/* Log events for UM operations, visible in -log_view.  Flops are counted
+roughly, for arithmetic on node coordinates.  */
+static PetscBool     UMEventsRegistered = PETSC_FALSE;
+static PetscLogEvent UM_Read, UM_Check, UM_Stats, UM_Adjacency, UM_Reorder,
+                     UM_Partition, UM_Distribute, UM_Refine, UM_Geometry,
+                     UM_Coloring, UM_Write;
+
+static PetscErrorCode UMRegisterEvents(void) {
+    PetscErrorCode ierr;
+    PetscClassId   classid;
+    if (UMEventsRegistered)
+        return 0;
+    ierr = PetscClassIdRegister("UM mesh",&classid); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMRead",classid,&UM_Read); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMCheck",classid,&UM_Check); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMStats",classid,&UM_Stats); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMAdjacency",classid,&UM_Adjacency); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMReorder",classid,&UM_Reorder); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMPartition",classid,&UM_Partition); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMDistribute",classid,&UM_Distribute); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMRefine",classid,&UM_Refine); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMGeometry",classid,&UM_Geometry); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMColoring",classid,&UM_Coloring); CHKERRQ(ierr);
+    ierr = PetscLogEventRegister("UMWrite",classid,&UM_Write); CHKERRQ(ierr);
+    UMEventsRegistered = PETSC_TRUE;
+    return 0;
+}
+
 PetscErrorCode UMInitialize(UM *mesh) {
+    PetscErrorCode ierr;
+    ierr = UMRegisterEvents(); CHKERRQ(ierr);
     mesh->N = 0;
     mesh->K = 0;
     mesh->P = 0;
@@ -10,15 +46,50 @@ PetscErrorCode UMInitialize(UM *mesh) {
     mesh->bfn = NULL;
     mesh->s = NULL;
     mesh->bfs = NULL;
+    mesh->Nown = 0;
+    mesh->Nglobal = 0;
+    mesh->ltog = NULL;
+    mesh->app = NULL;
+    mesh->geom = NULL;
+    mesh->part = NULL;
+    mesh->nparts = 0;
+    mesh->map = NULL;
+    mesh->maplen = 0;
+    mesh->ncolors = 0;
+    mesh->colorptr = NULL;
+    mesh->colorelt = NULL;
+    mesh->bytesread = 0.0;
     return 0;
 }
 
+static void UMGeometryDestroy(UMGeometry **geom) {
+    if (!(*geom))
+        return;
+    if (!(*geom)->mapped) {
+        PetscFree((*geom)->absdetJ);
+        PetscFree((*geom)->gx);
+        PetscFree((*geom)->gy);
+        PetscFree((*geom)->xq);
+        PetscFree((*geom)->yq);
+    }
+    PetscFree(*geom);
+    *geom = NULL;
+}
+
 PetscErrorCode UMDestroy(UM *mesh) {
     VecDestroy(&(mesh->loc));
     ISDestroy(&(mesh->e));
     ISDestroy(&(mesh->bfn));
     ISDestroy(&(mesh->s));
     ISDestroy(&(mesh->bfs));
+    ISLocalToGlobalMappingDestroy(&(mesh->ltog));
+    ISDestroy(&(mesh->app));
+    UMGeometryDestroy(&(mesh->geom));
+    PetscFree(mesh->part);
+    PetscFree(mesh->colorptr);
+    PetscFree(mesh->colorelt);
+    if (mesh->map)  // only after the Vec and ISs which use it
+        munmap(mesh->map,mesh->maplen);
     return 0;
 }
 
@@ -89,18 +160,196 @@ PetscErrorCode UMViewASCII(UM *mesh, PetscViewer viewer) {
 }
 
 
+// u is written in the node order of the mesh file, so petsc2contour.py works
+// after UMDistribute()
 PetscErrorCode UMViewSolutionBinary(UM *mesh, char *filename, Vec u) {
     PetscErrorCode ierr;
     int         Nu;
     PetscViewer viewer;
     ierr = VecGetSize(u,&Nu); CHKERRQ(ierr);
-    if (Nu != mesh->N) {
+    if (Nu != mesh->Nglobal) {
         SETERRQ2(PETSC_COMM_WORLD,1,
-           "incompatible sizes of u (=%d) and number of nodes (=%d)\n",Nu,mesh->N);
+           "incompatible sizes of u (=%d) and number of nodes (=%d)\n",Nu,mesh->Nglobal);
     }
+    ierr = PetscLogEventBegin(UM_Write,0,0,0,0); CHKERRQ(ierr);
     ierr = PetscViewerBinaryOpen(PETSC_COMM_WORLD,filename,FILE_MODE_WRITE,&viewer); CHKERRQ(ierr);
-    ierr = VecView(u,viewer); CHKERRQ(ierr);
+    if (mesh->app) {
+        Vec          ufile;
+        const int    *aapp;
+        const double *au;
+        ierr = VecDuplicate(u,&ufile); CHKERRQ(ierr);
+        ierr = ISGetIndices(mesh->app,&aapp); CHKERRQ(ierr);
+        ierr = VecGetArrayRead(u,&au); CHKERRQ(ierr);
+        ierr = VecSetValues(ufile,mesh->Nown,aapp,au,INSERT_VALUES); CHKERRQ(ierr);
+        ierr = VecRestoreArrayRead(u,&au); CHKERRQ(ierr);
+        ierr = ISRestoreIndices(mesh->app,&aapp); CHKERRQ(ierr);
+        ierr = VecAssemblyBegin(ufile); CHKERRQ(ierr);
+        ierr = VecAssemblyEnd(ufile); CHKERRQ(ierr);
+        ierr = VecView(ufile,viewer); CHKERRQ(ierr);
+        VecDestroy(&ufile);
+    } else {
+        ierr = VecView(u,viewer); CHKERRQ(ierr);
+    }
     ierr = PetscViewerDestroy(&viewer); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Write,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+/* VTK XML unstructured grid with one appended raw binary block, so each array
+is written by a single fwrite() with no encoding.  Each array in the block is
+preceded by its length in bytes as a UInt64, and the offset attribute of a
+DataArray is relative to the "_" which starts the block.  */
+static PetscErrorCode UMVTKWriteArray(FILE *fp, const void *data, size_t bytes) {
+    const unsigned long long nbytes = bytes;
+    if (fwrite(&nbytes,sizeof(nbytes),1,fp) != 1
+        || (bytes > 0 && fwrite(data,1,bytes,fp) != bytes)) {
+        SETERRQ(PETSC_COMM_SELF,1,"write of VTK file failed\n");
+    }
+    return 0;
+}
+
+PetscErrorCode UMViewSolutionVTK(UM *mesh, const char *root, Vec u) {
+    PetscErrorCode ierr;
+    MPI_Comm       comm;
+    PetscMPIInt    rank, size;
+    const int      one = 1, *ae, *idx, *en;
+    const char     *byteorder = (*(const char*)&one == 1) ? "LittleEndian" : "BigEndian",
+                   *base;
+    const Node     *aloc;
+    const double   *aul;
+    Vec            uloc;
+    VecScatter     ltog;
+    FILE           *fp;
+    char           filename[PETSC_MAX_PATH_LEN];
+    double         *xyz;
+    int            *conn, *offs, Nu, Kw, k, l, m, n, p;
+    unsigned char  *types;
+    size_t         off[5];
+
+    ierr = VecGetSize(u,&Nu); CHKERRQ(ierr);
+    if (Nu != mesh->Nglobal) {
+        SETERRQ2(PETSC_COMM_WORLD,1,
+           "incompatible sizes of u (=%d) and number of nodes (=%d)\n",Nu,mesh->Nglobal);
+    }
+    ierr = PetscLogEventBegin(UM_Write,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscObjectGetComm((PetscObject)u,&comm); CHKERRQ(ierr);
+    ierr = MPI_Comm_rank(comm,&rank); CHKERRQ(ierr);
+    ierr = MPI_Comm_size(comm,&size); CHKERRQ(ierr);
+    ierr = UMCreateGlobalToLocal(mesh,u,&uloc,&ltog); CHKERRQ(ierr);
+    ierr = VecScatterBegin(ltog,u,uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(ltog,u,uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+
+    // an element is written by the process which owns its node of least
+    // global index, so elements on several processes appear once
+    ierr = PetscMalloc1(3*mesh->N,&xyz); CHKERRQ(ierr);
+    ierr = PetscMalloc3(3*mesh->K,&conn,mesh->K,&offs,mesh->K,&types); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    for (n = 0; n < mesh->N; n++) {
+        xyz[3*n+0] = aloc[n].x;
+        xyz[3*n+1] = aloc[n].y;
+        xyz[3*n+2] = 0.0;
+    }
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISLocalToGlobalMappingGetIndices(mesh->ltog,&idx); CHKERRQ(ierr);
+    Kw = 0;
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        m = 0;
+        for (l = 1; l < 3; l++)
+            if (idx[en[l]] < idx[en[m]])
+                m = l;
+        if (en[m] >= mesh->Nown)
+            continue;
+        for (l = 0; l < 3; l++)
+            conn[3*Kw+l] = en[l];
+        offs[Kw] = 3 * (Kw + 1);
+        types[Kw] = 5;  // VTK_TRIANGLE
+        Kw++;
+    }
+    ierr = ISLocalToGlobalMappingRestoreIndices(mesh->ltog,&idx); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+
+    // offsets into appended block of u, points, connectivity, offsets, types
+    off[0] = 0;
+    off[1] = off[0] + 8 + mesh->N * sizeof(double);
+    off[2] = off[1] + 8 + 3 * mesh->N * sizeof(double);
+    off[3] = off[2] + 8 + 3 * Kw * sizeof(int);
+    off[4] = off[3] + 8 + Kw * sizeof(int);
+
+    // every process writes its piece
+    base = strrchr(root,'/');
+    base = (base) ? base + 1 : root;
+    if (size == 1) {
+        ierr = PetscSNPrintf(filename,sizeof(filename),"%s.vtu",root); CHKERRQ(ierr);
+    } else {
+        ierr = PetscSNPrintf(filename,sizeof(filename),"%s_%d.vtu",root,rank); CHKERRQ(ierr);
+    }
+    fp = fopen(filename,"wb");
+    if (!fp) {
+        SETERRQ1(PETSC_COMM_SELF,2,"unable to open %s for writing\n",filename);
+    }
+    fprintf(fp,"<?xml version=\"1.0\"?>\n"
+               "<VTKFile type=\"UnstructuredGrid\" version=\"0.1\" byte_order=\"%s\" header_type=\"UInt64\">\n"
+               "  <UnstructuredGrid>\n"
+               "    <Piece NumberOfPoints=\"%d\" NumberOfCells=\"%d\">\n"
+               "      <PointData Scalars=\"u\">\n"
+               "        <DataArray type=\"Float64\" Name=\"u\" format=\"appended\" offset=\"%lu\"/>\n"
+               "      </PointData>\n"
+               "      <Points>\n"
+               "        <DataArray type=\"Float64\" NumberOfComponents=\"3\" format=\"appended\" offset=\"%lu\"/>\n"
+               "      </Points>\n"
+               "      <Cells>\n"
+               "        <DataArray type=\"Int32\" Name=\"connectivity\" format=\"appended\" offset=\"%lu\"/>\n"
+               "        <DataArray type=\"Int32\" Name=\"offsets\" format=\"appended\" offset=\"%lu\"/>\n"
+               "        <DataArray type=\"UInt8\" Name=\"types\" format=\"appended\" offset=\"%lu\"/>\n"
+               "      </Cells>\n"
+               "    </Piece>\n"
+               "  </UnstructuredGrid>\n"
+               "  <AppendedData encoding=\"raw\">\n_",
+            byteorder,mesh->N,Kw,(unsigned long)off[0],(unsigned long)off[1],
+            (unsigned long)off[2],(unsigned long)off[3],(unsigned long)off[4]);
+    ierr = VecGetArrayRead(uloc,&aul); CHKERRQ(ierr);
+    ierr = UMVTKWriteArray(fp,aul,mesh->N * sizeof(double)); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(uloc,&aul); CHKERRQ(ierr);
+    ierr = UMVTKWriteArray(fp,xyz,3 * mesh->N * sizeof(double)); CHKERRQ(ierr);
+    ierr = UMVTKWriteArray(fp,conn,3 * Kw * sizeof(int)); CHKERRQ(ierr);
+    ierr = UMVTKWriteArray(fp,offs,Kw * sizeof(int)); CHKERRQ(ierr);
+    ierr = UMVTKWriteArray(fp,types,Kw); CHKERRQ(ierr);
+    fprintf(fp,"\n  </AppendedData>\n</VTKFile>\n");
+    if (fclose(fp)) {
+        SETERRQ1(PETSC_COMM_SELF,3,"write of %s failed\n",filename);
+    }
+    ierr = PetscFree(xyz); CHKERRQ(ierr);
+    ierr = PetscFree3(conn,offs,types); CHKERRQ(ierr);
+    VecDestroy(&uloc);
+    VecScatterDestroy(&ltog);
+
+    // in parallel, rank 0 writes the file which lists the pieces
+    if (size > 1 && rank == 0) {
+        ierr = PetscSNPrintf(filename,sizeof(filename),"%s.pvtu",root); CHKERRQ(ierr);
+        fp = fopen(filename,"w");
+        if (!fp) {
+            SETERRQ1(PETSC_COMM_SELF,2,"unable to open %s for writing\n",filename);
+        }
+        fprintf(fp,"<?xml version=\"1.0\"?>\n"
+                   "<VTKFile type=\"PUnstructuredGrid\" version=\"0.1\" byte_order=\"%s\" header_type=\"UInt64\">\n"
+                   "  <PUnstructuredGrid GhostLevel=\"0\">\n"
+                   "    <PPointData Scalars=\"u\">\n"
+                   "      <PDataArray type=\"Float64\" Name=\"u\"/>\n"
+                   "    </PPointData>\n"
+                   "    <PPoints>\n"
+                   "      <PDataArray type=\"Float64\" NumberOfComponents=\"3\"/>\n"
+                   "    </PPoints>\n",byteorder);
+        for (p = 0; p < size; p++)
+            fprintf(fp,"    <Piece Source=\"%s_%d.vtu\"/>\n",base,p);
+        fprintf(fp,"  </PUnstructuredGrid>\n</VTKFile>\n");
+        if (fclose(fp)) {
+            SETERRQ1(PETSC_COMM_SELF,3,"write of %s failed\n",filename);
+        }
+    }
+    ierr = PetscLogEventEnd(UM_Write,0,0,0,0); CHKERRQ(ierr);
     return 0;
 }
 
@@ -112,9 +361,11 @@ PetscErrorCode UMReadNodes(UM *mesh, char *filename) {
     if (mesh->N > 0) {
         SETERRQ(PETSC_COMM_WORLD,1,"nodes already created?\n");
     }
-    ierr = VecCreate(PETSC_COMM_WORLD,&mesh->loc); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Read,0,0,0,0); CHKERRQ(ierr);
+    // every process reads the whole mesh; see UMDistribute()
+    ierr = VecCreate(PETSC_COMM_SELF,&mesh->loc); CHKERRQ(ierr);
     ierr = VecSetFromOptions(mesh->loc); CHKERRQ(ierr);
-    ierr = PetscViewerBinaryOpen(PETSC_COMM_WORLD,filename,FILE_MODE_READ,&viewer); CHKERRQ(ierr);
+    ierr = PetscViewerBinaryOpen(PETSC_COMM_SELF,filename,FILE_MODE_READ,&viewer); CHKERRQ(ierr);
     ierr = VecLoad(mesh->loc,viewer); CHKERRQ(ierr);
     ierr = PetscViewerDestroy(&viewer); CHKERRQ(ierr);
     ierr = VecGetSize(mesh->loc,&twoN); CHKERRQ(ierr);
@@ -122,6 +373,10 @@ PetscErrorCode UMReadNodes(UM *mesh, char *filename) {
         SETERRQ1(PETSC_COMM_WORLD,2,"node locations loaded from %s are not N pairs\n",filename);
     }
     mesh->N = twoN / 2;
+    mesh->Nown = mesh->N;
+    mesh->Nglobal = mesh->N;
+    mesh->bytesread += 2 * mesh->N * sizeof(double);
+    ierr = PetscLogEventEnd(UM_Read,0,0,0,0); CHKERRQ(ierr);
     return 0;
 }
 
@@ -138,6 +393,7 @@ PetscErrorCode UMCheckElements(UM *mesh) {
         SETERRQ(PETSC_COMM_WORLD,2,
                 "node size unknown so element check impossible; call UMReadNodes() first\n");
     }
+    ierr = PetscLogEventBegin(UM_Check,0,0,0,0); CHKERRQ(ierr);
     ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
     for (k = 0; k < mesh->K; k++) {
         for (m = 0; m < 3; m++) {
@@ -150,6 +406,7 @@ PetscErrorCode UMCheckElements(UM *mesh) {
         // FIXME: could add check for distinct indices
     }
     ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Check,0,0,0,0); CHKERRQ(ierr);
     return 0;
 }
 
@@ -173,6 +430,7 @@ PetscErrorCode UMCheckBoundaryData(UM *mesh) {
         SETERRQ(PETSC_COMM_WORLD,4,
                 "boundary flags at segments not allocated; call UMReadElements() first\n");
     }
+    ierr = PetscLogEventBegin(UM_Check,0,0,0,0); CHKERRQ(ierr);
     ierr = ISGetIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
     for (n = 0; n < mesh->N; n++) {
         switch (abfn[n]) {
@@ -212,6 +470,7 @@ PetscErrorCode UMCheckBoundaryData(UM *mesh) {
         }
     }
     ierr = ISRestoreIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Check,0,0,0,0); CHKERRQ(ierr);
     return 0;
 }
 
@@ -227,9 +486,10 @@ PetscErrorCode UMReadISs(UM *mesh, char *filename) {
         SETERRQ(PETSC_COMM_WORLD,2,
                 "node coordinates not created ... do that first ... stopping\n");
     }
-    ierr = PetscViewerBinaryOpen(PETSC_COMM_WORLD,filename,FILE_MODE_READ,&viewer); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Read,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscViewerBinaryOpen(PETSC_COMM_SELF,filename,FILE_MODE_READ,&viewer); CHKERRQ(ierr);
     // create and load e
-    ierr = ISCreate(PETSC_COMM_WORLD,&(mesh->e)); CHKERRQ(ierr);
+    ierr = ISCreate(PETSC_COMM_SELF,&(mesh->e)); CHKERRQ(ierr);
     ierr = ISLoad(mesh->e,viewer); CHKERRQ(ierr);
     ierr = ISGetSize(mesh->e,&(mesh->K)); CHKERRQ(ierr);
     if (mesh->K % 3 != 0) {
@@ -238,7 +498,7 @@ PetscErrorCode UMReadISs(UM *mesh, char *filename) {
     }
     mesh->K /= 3;
     // create and load bfn
-    ierr = ISCreate(PETSC_COMM_WORLD,&(mesh->bfn)); CHKERRQ(ierr);
+    ierr = ISCreate(PETSC_COMM_SELF,&(mesh->bfn)); CHKERRQ(ierr);
     ierr = ISLoad(mesh->bfn,viewer); CHKERRQ(ierr);
     ierr = ISGetSize(mesh->bfn,&n_bfn); CHKERRQ(ierr);
     if (n_bfn != mesh->N) {
@@ -246,7 +506,7 @@ PetscErrorCode UMReadISs(UM *mesh, char *filename) {
                  "IS bfn loaded from %s is wrong size\n",filename);
     }
     // create and load s
-    ierr = ISCreate(PETSC_COMM_WORLD,&(mesh->s)); CHKERRQ(ierr);
+    ierr = ISCreate(PETSC_COMM_SELF,&(mesh->s)); CHKERRQ(ierr);
     ierr = ISLoad(mesh->s,viewer); CHKERRQ(ierr);
     ierr = ISGetSize(mesh->s,&(mesh->P)); CHKERRQ(ierr);
     if (mesh->P % 2 != 0) {
@@ -255,7 +515,7 @@ PetscErrorCode UMReadISs(UM *mesh, char *filename) {
     }
     mesh->P /= 2;
     // create and load bfn
-    ierr = ISCreate(PETSC_COMM_WORLD,&(mesh->bfs)); CHKERRQ(ierr);
+    ierr = ISCreate(PETSC_COMM_SELF,&(mesh->bfs)); CHKERRQ(ierr);
     ierr = ISLoad(mesh->bfs,viewer); CHKERRQ(ierr);
     ierr = ISGetSize(mesh->bfs,&n_bfs); CHKERRQ(ierr);
     if (n_bfs != mesh->P) {
@@ -264,19 +524,524 @@ PetscErrorCode UMReadISs(UM *mesh, char *filename) {
     }
     // mesh should be complete now
     ierr = PetscViewerDestroy(&viewer); CHKERRQ(ierr);
+    mesh->bytesread += (3 * mesh->K + mesh->N + 3 * mesh->P) * sizeof(int);
+    ierr = PetscLogEventEnd(UM_Read,0,0,0,0); CHKERRQ(ierr);
+    ierr = UMCheckElements(mesh); CHKERRQ(ierr);
+    ierr = UMCheckBoundaryData(mesh); CHKERRQ(ierr);
+    return 0;
+}
+
+// read whole text file into a NUL-terminated buffer with one fread()
+static PetscErrorCode TriangleLoadFile(const char *filename, char **buf,
+                                       PetscLogDouble *bytes) {
+    PetscErrorCode ierr;
+    FILE   *fp;
+    long   len;
+    size_t got;
+    fp = fopen(filename,"r");
+    if (!fp) {
+        SETERRQ1(PETSC_COMM_SELF,1,"unable to open %s\n",filename);
+    }
+    fseek(fp,0,SEEK_END);
+    len = ftell(fp);
+    fseek(fp,0,SEEK_SET);
+    ierr = PetscMalloc1(len+1,buf); CHKERRQ(ierr);
+    got = fread(*buf,1,(size_t)len,fp);
+    fclose(fp);
+    if ((long)got != len) {
+        SETERRQ1(PETSC_COMM_SELF,2,"unable to read all of %s\n",filename);
+    }
+    (*buf)[len] = '\0';
+    *bytes += len;
+    return 0;
+}
+
+// skip white space and '#' comments (to end of line)
+static char* TriangleSkip(char *p) {
+    while (*p) {
+        if (*p == '#') {
+            while (*p && *p != '\n')
+                p++;
+        } else if (isspace((unsigned char)*p)) {
+            p++;
+        } else
+            break;
+    }
+    return p;
+}
+
+static PetscErrorCode TriangleInt(char **p, const char *filename, int *v) {
+    char *end;
+    *p = TriangleSkip(*p);
+    *v = (int)strtol(*p,&end,10);
+    if (end == *p) {
+        SETERRQ1(PETSC_COMM_SELF,3,"expected integer not found in %s\n",filename);
+    }
+    *p = end;
+    return 0;
+}
+
+static PetscErrorCode TriangleDouble(char **p, const char *filename, double *v) {
+    char *end;
+    *p = TriangleSkip(*p);
+    *v = strtod(*p,&end);
+    if (end == *p) {
+        SETERRQ1(PETSC_COMM_SELF,3,"expected real number not found in %s\n",filename);
+    }
+    *p = end;
+    return 0;
+}
+
+/* Parse root.node, root.ele, root.poly into arrays.  This duplicates
+tri2petsc.py:  bfn comes from the node boundary markers, while s and bfs come
+from the segments (and their markers) in the .poly file.  Node attributes
+and extra element nodes are skipped.  Indices may start at 0 or 1, as
+indicated by the first node in the .node file.  The .node file must have
+boundary markers, because bfn is needed for Dirichlet conditions.  On error,
+whatever is allocated so far (including the file buffer *buf) is freed by
+TriangleParse() below. */
+static PetscErrorCode TriangleParseFiles(const char *root, char **buf,
+                                         int *N, int *K, int *P,
+                                         double **loc, int **e, int **bfn,
+                                         int **s, int **bfs, PetscLogDouble *bytes) {
+    PetscErrorCode ierr;
+    char   filename[PETSC_MAX_PATH_LEN], *p;
+    int    n, k, j, l, base, idx, dim, nattr, nmark, nper, PN, tmp;
+    double dtmp;
+
+    // .node:  N dim nattr nmarkers, then  n x y [attributes] [marker]
+    ierr = PetscSNPrintf(filename,sizeof(filename),"%s.node",root); CHKERRQ(ierr);
+    ierr = TriangleLoadFile(filename,buf,bytes); CHKERRQ(ierr);
+    p = *buf;
+    ierr = TriangleInt(&p,filename,N); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&dim); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nattr); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nmark); CHKERRQ(ierr);
+    if (*N <= 0 || dim != 2) {
+        SETERRQ1(PETSC_COMM_SELF,4,"invalid header in %s\n",filename);
+    }
+    if (nmark <= 0) {
+        SETERRQ1(PETSC_COMM_SELF,4,"no boundary markers in %s\n",filename);
+    }
+    ierr = PetscMalloc1(2 * *N,loc); CHKERRQ(ierr);
+    ierr = PetscCalloc1(*N,bfn); CHKERRQ(ierr);
+    base = 0;
+    for (n = 0; n < *N; n++) {
+        ierr = TriangleInt(&p,filename,&idx); CHKERRQ(ierr);
+        if (n == 0)
+            base = idx;
+        if (idx != n + base) {
+            SETERRQ1(PETSC_COMM_SELF,5,"indexing wrong in reading nodes from %s\n",filename);
+        }
+        ierr = TriangleDouble(&p,filename,&((*loc)[2*n+0])); CHKERRQ(ierr);
+        ierr = TriangleDouble(&p,filename,&((*loc)[2*n+1])); CHKERRQ(ierr);
+        for (j = 0; j < nattr; j++) {
+            ierr = TriangleDouble(&p,filename,&dtmp); CHKERRQ(ierr);
+        }
+        ierr = TriangleInt(&p,filename,&((*bfn)[n])); CHKERRQ(ierr);
+    }
+    ierr = PetscFree(*buf); CHKERRQ(ierr);
+
+    // .ele:  K nodespertriangle nattr, then  k n0 n1 n2 [...] [attributes]
+    ierr = PetscSNPrintf(filename,sizeof(filename),"%s.ele",root); CHKERRQ(ierr);
+    ierr = TriangleLoadFile(filename,buf,bytes); CHKERRQ(ierr);
+    p = *buf;
+    ierr = TriangleInt(&p,filename,K); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nper); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nattr); CHKERRQ(ierr);
+    if (*K <= 0 || nper < 3) {
+        SETERRQ1(PETSC_COMM_SELF,4,"invalid header in %s\n",filename);
+    }
+    ierr = PetscMalloc1(3 * *K,e); CHKERRQ(ierr);
+    for (k = 0; k < *K; k++) {
+        ierr = TriangleInt(&p,filename,&idx); CHKERRQ(ierr);
+        if (idx != k + base) {
+            SETERRQ1(PETSC_COMM_SELF,5,"indexing wrong in reading elements from %s\n",filename);
+        }
+        for (l = 0; l < nper; l++) {
+            ierr = TriangleInt(&p,filename,&tmp); CHKERRQ(ierr);
+            if (l < 3)
+                (*e)[3*k+l] = tmp - base;
+        }
+        for (j = 0; j < nattr; j++) {
+            ierr = TriangleDouble(&p,filename,&dtmp); CHKERRQ(ierr);
+        }
+    }
+    ierr = PetscFree(*buf); CHKERRQ(ierr);
+
+    // .poly:  PN dim nattr nmarkers (and PN nodes, normally none), then
+    //         P nmarkers, then  p n0 n1 [marker];  holes are ignored
+    ierr = PetscSNPrintf(filename,sizeof(filename),"%s.poly",root); CHKERRQ(ierr);
+    ierr = TriangleLoadFile(filename,buf,bytes); CHKERRQ(ierr);
+    p = *buf;
+    ierr = TriangleInt(&p,filename,&PN); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&dim); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nattr); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nmark); CHKERRQ(ierr);
+    for (n = 0; n < PN; n++) {
+        ierr = TriangleInt(&p,filename,&idx); CHKERRQ(ierr);
+        for (j = 0; j < 2 + nattr; j++) {
+            ierr = TriangleDouble(&p,filename,&dtmp); CHKERRQ(ierr);
+        }
+        if (nmark > 0) {
+            ierr = TriangleInt(&p,filename,&tmp); CHKERRQ(ierr);
+        }
+    }
+    ierr = TriangleInt(&p,filename,P); CHKERRQ(ierr);
+    ierr = TriangleInt(&p,filename,&nmark); CHKERRQ(ierr);
+    if (*P <= 0) {
+        SETERRQ1(PETSC_COMM_SELF,4,"no boundary segments in %s\n",filename);
+    }
+    ierr = PetscMalloc1(2 * *P,s); CHKERRQ(ierr);
+    ierr = PetscCalloc1(*P,bfs); CHKERRQ(ierr);
+    for (j = 0; j < *P; j++) {
+        ierr = TriangleInt(&p,filename,&idx); CHKERRQ(ierr);
+        if (idx != j + base) {
+            SETERRQ1(PETSC_COMM_SELF,5,"indexing wrong in reading segments from %s\n",filename);
+        }
+        for (l = 0; l < 2; l++) {
+            ierr = TriangleInt(&p,filename,&tmp); CHKERRQ(ierr);
+            (*s)[2*j+l] = tmp - base;
+        }
+        if (nmark > 0) {
+            ierr = TriangleInt(&p,filename,&((*bfs)[j])); CHKERRQ(ierr);
+        }
+    }
+    ierr = PetscFree(*buf); CHKERRQ(ierr);
+    return 0;
+}
+
+static PetscErrorCode TriangleParse(const char *root, int *N, int *K, int *P,
+                                    double **loc, int **e, int **bfn,
+                                    int **s, int **bfs, PetscLogDouble *bytes) {
+    PetscErrorCode perr;
+    char           *buf = NULL;
+    perr = TriangleParseFiles(root,&buf,N,K,P,loc,e,bfn,s,bfs,bytes);
+    if (perr) {
+        PetscFree(buf);
+        PetscFree(*loc);
+        PetscFree(*e);
+        PetscFree(*bfn);
+        PetscFree(*s);
+        PetscFree(*bfs);
+    }
+    return perr;
+}
+
+PetscErrorCode UMReadTriangle(UM *mesh, const char *root) {
+    PetscErrorCode ierr, perr = 0;
+    PetscMPIInt rank;
+    int         sizes[3] = {-1, 0, 0}, *e = NULL, *bfn = NULL, *s = NULL, *bfs = NULL;
+    double      *loc = NULL, *aloc;
+    if ((mesh->N > 0) || (mesh->K > 0) || (mesh->P > 0)) {
+        SETERRQ(PETSC_COMM_WORLD,1,"mesh already created? ... stopping\n");
+    }
+    ierr = PetscLogEventBegin(UM_Read,0,0,0,0); CHKERRQ(ierr);
+    // rank 0 parses; the other processes must not hang if it fails
+    ierr = MPI_Comm_rank(PETSC_COMM_WORLD,&rank); CHKERRQ(ierr);
+    if (rank == 0) {
+        perr = TriangleParse(root,&sizes[0],&sizes[1],&sizes[2],
+                             &loc,&e,&bfn,&s,&bfs,&(mesh->bytesread));
+        if (perr)
+            sizes[0] = -1;
+    }
+    ierr = MPI_Bcast(sizes,3,MPI_INT,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    if (sizes[0] < 0) {
+        SETERRQ1(PETSC_COMM_WORLD,2,"failed to read triangle mesh %s.{node,ele,poly}\n",root);
+    }
+    mesh->N = sizes[0];
+    mesh->K = sizes[1];
+    mesh->P = sizes[2];
+    if (rank > 0) {
+        ierr = PetscMalloc1(2*mesh->N,&loc); CHKERRQ(ierr);
+        ierr = PetscMalloc1(3*mesh->K,&e); CHKERRQ(ierr);
+        ierr = PetscMalloc1(mesh->N,&bfn); CHKERRQ(ierr);
+        ierr = PetscMalloc1(2*mesh->P,&s); CHKERRQ(ierr);
+        ierr = PetscMalloc1(mesh->P,&bfs); CHKERRQ(ierr);
+    }
+    // every process gets the whole mesh; see UMDistribute()
+    ierr = MPI_Bcast(loc,2*mesh->N,MPI_DOUBLE,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = MPI_Bcast(e,3*mesh->K,MPI_INT,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = MPI_Bcast(bfn,mesh->N,MPI_INT,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = MPI_Bcast(s,2*mesh->P,MPI_INT,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = MPI_Bcast(bfs,mesh->P,MPI_INT,0,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = VecCreateSeq(PETSC_COMM_SELF,2*mesh->N,&(mesh->loc)); CHKERRQ(ierr);
+    ierr = VecGetArray(mesh->loc,&aloc); CHKERRQ(ierr);
+    ierr = PetscMemcpy(aloc,loc,2*mesh->N*sizeof(double)); CHKERRQ(ierr);
+    ierr = VecRestoreArray(mesh->loc,&aloc); CHKERRQ(ierr);
+    ierr = PetscFree(loc); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,3*mesh->K,e,PETSC_OWN_POINTER,&(mesh->e)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,mesh->N,bfn,PETSC_OWN_POINTER,&(mesh->bfn)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,2*mesh->P,s,PETSC_OWN_POINTER,&(mesh->s)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,mesh->P,bfs,PETSC_OWN_POINTER,&(mesh->bfs)); CHKERRQ(ierr);
+    mesh->Nown = mesh->N;
+    mesh->Nglobal = mesh->N;
+    ierr = PetscLogEventEnd(UM_Read,0,0,0,0); CHKERRQ(ierr);
     ierr = UMCheckElements(mesh); CHKERRQ(ierr);
     ierr = UMCheckBoundaryData(mesh); CHKERRQ(ierr);
     return 0;
 }
 
+/* Compact mesh file, read by mapping it into memory.  All values are
+little-endian; integers are 32 bit.  A 64 byte header is followed by these
+sections, each starting at a multiple of 8 bytes:
+    loc      2N doubles
+    e        3K ints
+    bfn      N ints
+    s        2P ints
+    bfs      P ints
+    geometry (if quaddegree > 0) doubles absdetJ[K], gx[3K], gy[3K],
+             xq[nq K], yq[nq K]
+    part     (if nparts > 0) N ints
+Increase UMCOMPACT_VERSION if this changes.  */
+#define UMCOMPACT_VERSION 1
+typedef struct {
+    char     magic[8];  // "p4pdesUM"
+    int      version,
+             N, K, P,
+             quaddegree,// of cached geometry, or 0 if none
+             nq,        // number of quadrature points for geometry
+             nparts,    // number of processes in partition table, or 0
+             reserved[7];
+} UMCompactHeader;
+
+#define UMCOMPACT_NSECTIONS 7
+static size_t UMCompactLayout(const UMCompactHeader *h,
+                              size_t offset[UMCOMPACT_NSECTIONS]) {
+    size_t bytes[UMCOMPACT_NSECTIONS], off = sizeof(UMCompactHeader);
+    int    j;
+    bytes[0] = 2 * (size_t)h->N * sizeof(double);
+    bytes[1] = 3 * (size_t)h->K * sizeof(int);
+    bytes[2] = (size_t)h->N * sizeof(int);
+    bytes[3] = 2 * (size_t)h->P * sizeof(int);
+    bytes[4] = (size_t)h->P * sizeof(int);
+    bytes[5] = (h->quaddegree > 0) ? (7 + 2 * (size_t)h->nq) * h->K * sizeof(double) : 0;
+    bytes[6] = (h->nparts > 0) ? (size_t)h->N * sizeof(int) : 0;
+    for (j = 0; j < UMCOMPACT_NSECTIONS; j++) {
+        offset[j] = off;
+        off += (bytes[j] + 7) & ~((size_t)7);
+    }
+    return off;
+}
 
+static PetscErrorCode UMCompactCheckHost(void) {
+    const int one = 1;
+    if (sizeof(int) != 4 || sizeof(PetscInt) != sizeof(int) || *(const char*)&one != 1) {
+        SETERRQ(PETSC_COMM_SELF,1,
+                "compact mesh format needs little-endian host with 32 bit PetscInt\n");
+    }
+    return 0;
+}
+
+static PetscErrorCode UMCompactWriteSection(FILE *fp, const void *data, size_t bytes) {
+    const char zeros[8] = {0,0,0,0,0,0,0,0};
+    if (bytes > 0 && fwrite(data,1,bytes,fp) != bytes) {
+        SETERRQ(PETSC_COMM_SELF,1,"write of compact mesh file failed\n");
+    }
+    if (bytes % 8 != 0 && fwrite(zeros,1,8 - bytes % 8,fp) != 8 - bytes % 8) {
+        SETERRQ(PETSC_COMM_SELF,1,"write of compact mesh file failed\n");
+    }
+    return 0;
+}
+
+PetscErrorCode UMWriteCompact(UM *mesh, const char *filename) {
+    PetscErrorCode ierr;
+    UMCompactHeader h;
+    FILE            *fp;
+    const Node      *aloc;
+    const int       *ae, *abfn, *as, *abfs;
+    size_t          K;
+    if ((!mesh->loc) || (mesh->N == 0) || (!mesh->e) || (!mesh->s)) {
+        SETERRQ(PETSC_COMM_SELF,1,"mesh not complete\n");
+    }
+    if (mesh->N != mesh->Nglobal) {
+        SETERRQ(PETSC_COMM_SELF,2,"only the whole mesh can be written; call before UMDistribute()\n");
+    }
+    ierr = UMCompactCheckHost(); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Write,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscMemzero(&h,sizeof(h)); CHKERRQ(ierr);
+    ierr = PetscMemcpy(h.magic,"p4pdesUM",8); CHKERRQ(ierr);
+    h.version = UMCOMPACT_VERSION;
+    h.N = mesh->N;
+    h.K = mesh->K;
+    h.P = mesh->P;
+    if (mesh->geom) {
+        h.quaddegree = mesh->geom->quaddegree;
+        h.nq = symmgauss[h.quaddegree-1].n;
+    }
+    if (mesh->part)
+        h.nparts = mesh->nparts;
+    fp = fopen(filename,"wb");
+    if (!fp) {
+        SETERRQ1(PETSC_COMM_SELF,3,"unable to open %s for writing\n",filename);
+    }
+    ierr = UMCompactWriteSection(fp,&h,sizeof(h)); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = UMCompactWriteSection(fp,aloc,2*(size_t)h.N*sizeof(double)); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMCompactWriteSection(fp,ae,3*(size_t)h.K*sizeof(int)); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMCompactWriteSection(fp,abfn,(size_t)h.N*sizeof(int)); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = UMCompactWriteSection(fp,as,2*(size_t)h.P*sizeof(int)); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    ierr = UMCompactWriteSection(fp,abfs,(size_t)h.P*sizeof(int)); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    if (mesh->geom) {  // written as one section; all lengths are multiples of 8
+        K = (size_t)h.K;
+        if (fwrite(mesh->geom->absdetJ,sizeof(double),K,fp) != K
+            || fwrite(mesh->geom->gx,sizeof(double),3*K,fp) != 3*K
+            || fwrite(mesh->geom->gy,sizeof(double),3*K,fp) != 3*K
+            || fwrite(mesh->geom->xq,sizeof(double),h.nq*K,fp) != h.nq*K
+            || fwrite(mesh->geom->yq,sizeof(double),h.nq*K,fp) != h.nq*K) {
+            SETERRQ(PETSC_COMM_SELF,4,"write of compact mesh file failed\n");
+        }
+    }
+    if (mesh->part) {
+        ierr = UMCompactWriteSection(fp,mesh->part,(size_t)h.N*sizeof(int)); CHKERRQ(ierr);
+    }
+    fclose(fp);
+    ierr = PetscLogEventEnd(UM_Write,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+// all node indices in e and s, and all entries of part, are in range
+static PetscErrorCode UMCompactCheckIndices(UM *mesh, const char *filename) {
+    PetscErrorCode ierr;
+    const int      *ae, *as;
+    int            j, bad = 0;
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (j = 0; j < 3*mesh->K; j++) {
+        if (ae[j] < 0 || ae[j] >= mesh->N)
+            bad = 1;
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->s,&as); CHKERRQ(ierr);
+    for (j = 0; j < 2*mesh->P; j++) {
+        if (as[j] < 0 || as[j] >= mesh->N)
+            bad = 1;
+    }
+    ierr = ISRestoreIndices(mesh->s,&as); CHKERRQ(ierr);
+    if (mesh->part) {
+        for (j = 0; j < mesh->N; j++) {
+            if (mesh->part[j] < 0 || mesh->part[j] >= mesh->nparts)
+                bad = 1;
+        }
+    }
+    if (bad) {
+        SETERRQ1(PETSC_COMM_SELF,8,"%s has node or partition indices out of range\n",filename);
+    }
+    return 0;
+}
+
+PetscErrorCode UMReadCompact(UM *mesh, const char *filename) {
+    PetscErrorCode  ierr;
+    UMCompactHeader h;
+    UMGeometry      *g;
+    struct stat     st;
+    size_t          offset[UMCOMPACT_NSECTIONS], total, K;
+    char            *base;
+    double          *ageom;
+    int             fd;
+    if ((mesh->N > 0) || (mesh->K > 0) || (mesh->P > 0)) {
+        SETERRQ(PETSC_COMM_SELF,1,"mesh already created? ... stopping\n");
+    }
+    ierr = UMCompactCheckHost(); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Read,0,0,0,0); CHKERRQ(ierr);
+    fd = open(filename,O_RDONLY);
+    if (fd < 0) {
+        SETERRQ1(PETSC_COMM_SELF,2,"unable to open %s\n",filename);
+    }
+    if (fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(h)) {
+        close(fd);
+        SETERRQ1(PETSC_COMM_SELF,3,"%s is not a compact mesh file\n",filename);
+    }
+    // private mapping:  pages are shared with the page cache and with other
+    // processes on the node, and are only copied if written
+    base = (char*)mmap(NULL,(size_t)st.st_size,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (base == (char*)MAP_FAILED) {
+        SETERRQ1(PETSC_COMM_SELF,4,"unable to map %s\n",filename);
+    }
+    mesh->map = base;
+    mesh->maplen = (size_t)st.st_size;
+    ierr = PetscMemcpy(&h,base,sizeof(h)); CHKERRQ(ierr);
+    if (strncmp(h.magic,"p4pdesUM",8) != 0) {
+        SETERRQ1(PETSC_COMM_SELF,3,"%s is not a compact mesh file\n",filename);
+    }
+    if (h.version != UMCOMPACT_VERSION) {
+        SETERRQ3(PETSC_COMM_SELF,5,"%s has version %d but version %d is expected\n",
+                 filename,h.version,UMCOMPACT_VERSION);
+    }
+    // header values are checked before they are used for offsets and indexing
+    if (h.N <= 0 || h.K <= 0 || h.P <= 0 || h.nparts < 0
+        || h.quaddegree < 0 || h.quaddegree > 5
+        || (h.quaddegree > 0 && h.nq != symmgauss[h.quaddegree-1].n)) {
+        SETERRQ1(PETSC_COMM_SELF,7,"%s has an invalid header\n",filename);
+    }
+    total = UMCompactLayout(&h,offset);
+    if (total > mesh->maplen) {
+        SETERRQ1(PETSC_COMM_SELF,6,"%s is truncated\n",filename);
+    }
+    mesh->N = h.N;
+    mesh->K = h.K;
+    mesh->P = h.P;
+    mesh->Nown = mesh->N;
+    mesh->Nglobal = mesh->N;
+    ierr = VecCreateSeqWithArray(PETSC_COMM_SELF,1,2*mesh->N,
+                                 (double*)(base + offset[0]),&(mesh->loc)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,3*mesh->K,(int*)(base + offset[1]),
+                           PETSC_USE_POINTER,&(mesh->e)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,mesh->N,(int*)(base + offset[2]),
+                           PETSC_USE_POINTER,&(mesh->bfn)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,2*mesh->P,(int*)(base + offset[3]),
+                           PETSC_USE_POINTER,&(mesh->s)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,mesh->P,(int*)(base + offset[4]),
+                           PETSC_USE_POINTER,&(mesh->bfs)); CHKERRQ(ierr);
+    if (h.quaddegree > 0) {
+        K = (size_t)h.K;
+        ageom = (double*)(base + offset[5]);
+        ierr = PetscNew(&g); CHKERRQ(ierr);
+        g->quaddegree = h.quaddegree;
+        g->absdetJ = ageom;
+        g->gx = ageom + K;
+        g->gy = ageom + 4*K;
+        g->xq = ageom + 7*K;
+        g->yq = ageom + (7+h.nq)*K;
+        g->mapped = PETSC_TRUE;
+        mesh->geom = g;
+    }
+    if (h.nparts > 0) {  // small, and freed by UMDistribute(), so copy
+        ierr = PetscMalloc1(mesh->N,&(mesh->part)); CHKERRQ(ierr);
+        ierr = PetscMemcpy(mesh->part,base + offset[6],mesh->N*sizeof(int)); CHKERRQ(ierr);
+        mesh->nparts = h.nparts;
+    }
+    // indices are checked so a damaged file gives an error rather than
+    // out-of-range access later; this reads the element, segment, and
+    // partition sections, but not the (larger) coordinate and geometry
+    // sections; other pages are read on first use, so the event time may be
+    // less than the time to read the file
+    ierr = UMCompactCheckIndices(mesh,filename); CHKERRQ(ierr);
+    mesh->bytesread += total;
+    ierr = PetscLogEventEnd(UM_Read,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+// after UMDistribute(), element k is counted on the process which owns
+// its first node, and the statistics are for the whole mesh
 PetscErrorCode UMStats(UM *mesh, double *maxh, double *meanh, double *maxa, double *meana) {
     PetscErrorCode ierr;
+    MPI_Comm    comm = PETSC_COMM_SELF;
     const int   *ae;
     const Node  *aloc;
     int         k;
     double      x[3], y[3], ax, ay, bx, by, cx, cy, h, a,
-                Maxh = 0.0, Maxa = 0.0, Sumh = 0.0, Suma = 0.0;
+                lmax[2] = {0.0, 0.0}, gmax[2], lsum[3] = {0.0, 0.0, 0.0}, gsum[3];
     if ((mesh->K == 0) || (mesh->e == NULL)) {
         SETERRQ(PETSC_COMM_WORLD,1,
                 "number of elements unknown; call UMReadElements() first\n");
@@ -285,9 +1050,12 @@ PetscErrorCode UMStats(UM *mesh, double *maxh, double *meanh, double *maxa, doub
         SETERRQ(PETSC_COMM_WORLD,2,
                 "node size unknown so element check impossible; call UMReadNodes() first\n");
     }
+    ierr = PetscLogEventBegin(UM_Stats,0,0,0,0); CHKERRQ(ierr);
     ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
     ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
     for (k = 0; k < mesh->K; k++) {
+        if (ae[3*k] >= mesh->Nown)
+            continue;
         x[0] = aloc[ae[3*k]].x;
         y[0] = aloc[ae[3*k]].y;
         x[1] = aloc[ae[3*k+1]].x;
@@ -303,17 +1071,25 @@ PetscErrorCode UMStats(UM *mesh, double *maxh, double *meanh, double *maxa, doub
         h = PetscMax(ax*ax+ay*ay, PetscMax(bx*bx+by*by, cx*cx+cy*cy));
         h = sqrt(h);
         a = 0.5 * PetscAbs(ax*by-ay*bx);
-        Maxh = PetscMax(Maxh,h);
-        Sumh += h;
-        Maxa = PetscMax(Maxa,a);
-        Suma += a;
+        lmax[0] = PetscMax(lmax[0],h);
+        lsum[0] += h;
+        lmax[1] = PetscMax(lmax[1],a);
+        lsum[1] += a;
+        lsum[2] += 1.0;
     }
     ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
     ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
-    if (maxh)  *maxh = Maxh;
-    if (maxa)  *maxa = Maxa;
-    if (meanh)  *meanh = Sumh / mesh->K;
-    if (meana)  *meana = Suma / mesh->K;
+    ierr = PetscLogFlops(28.0 * lsum[2]); CHKERRQ(ierr);
+    if (mesh->ltog) {
+        ierr = PetscObjectGetComm((PetscObject)(mesh->ltog),&comm); CHKERRQ(ierr);
+    }
+    ierr = MPI_Allreduce(lmax,gmax,2,MPI_DOUBLE,MPI_MAX,comm); CHKERRQ(ierr);
+    ierr = MPI_Allreduce(lsum,gsum,3,MPI_DOUBLE,MPI_SUM,comm); CHKERRQ(ierr);
+    if (maxh)  *maxh = gmax[0];
+    if (maxa)  *maxa = gmax[1];
+    if (meanh)  *meanh = gsum[0] / gsum[2];
+    if (meana)  *meana = gsum[1] / gsum[2];
+    ierr = PetscLogEventEnd(UM_Stats,0,0,0,0); CHKERRQ(ierr);
     return 0;
 }
 
@@ -336,3 +1112,1031 @@ PetscErrorCode UMRestoreNodeCoordArrayRead(UM *mesh, const Node **xy) {
     return 0;
 }
 
+
+
+PetscErrorCode UMNodeAdjacency(UM *mesh, int **ia, int **ja) {
+    PetscErrorCode ierr;
+    const int   *ae, *en;
+    int         *aia, *aja, *cnt, n, k, l, m, len, start, pos;
+    if ((mesh->K == 0) || (mesh->e == NULL)) {
+        SETERRQ(PETSC_COMM_WORLD,1,
+                "number of elements unknown; call UMReadElements() first\n");
+    }
+    // each element adds two (possibly repeated) neighbors to each of its nodes
+    ierr = PetscLogEventBegin(UM_Adjacency,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscCalloc1(mesh->N+1,&aia); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        for (l = 0; l < 3; l++)
+            aia[en[l]+1] += 2;
+    }
+    for (n = 0; n < mesh->N; n++)
+        aia[n+1] += aia[n];
+    ierr = PetscMalloc1(aia[mesh->N],&aja); CHKERRQ(ierr);
+    ierr = PetscCalloc1(mesh->N,&cnt); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        for (l = 0; l < 3; l++) {
+            for (m = 0; m < 3; m++) {
+                if (m != l) {
+                    aja[aia[en[l]] + cnt[en[l]]] = en[m];
+                    cnt[en[l]]++;
+                }
+            }
+        }
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = PetscFree(cnt); CHKERRQ(ierr);
+    // sort each row, remove duplicates, and compress
+    pos = 0;
+    for (n = 0; n < mesh->N; n++) {
+        start = aia[n];
+        len = aia[n+1] - start;
+        ierr = PetscSortRemoveDupsInt(&len,aja+start); CHKERRQ(ierr);
+        aia[n] = pos;
+        for (m = 0; m < len; m++)
+            aja[pos++] = aja[start+m];
+    }
+    aia[mesh->N] = pos;
+    *ia = aia;
+    *ja = aja;
+    ierr = PetscLogEventEnd(UM_Adjacency,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+/* Edge (a,b) with a < b is numbered by its position among the neighbors of
+a which are larger than a; these are the tail of a's sorted neighbor list
+from UMNodeAdjacency().  */
+static int UMEdgeIndex(const int *ia, const int *ja, const int *first,
+                       int a, int b) {
+    int lo, hi, mid, nsmall, tmp;
+    if (a > b) {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    lo = ia[a];
+    hi = ia[a+1] - 1;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (ja[mid] == b) {
+            nsmall = (ia[a+1] - ia[a]) - (first[a+1] - first[a]);
+            return first[a] + (mid - ia[a]) - nsmall;
+        } else if (ja[mid] < b)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+PetscErrorCode UMCreateEdges(UM *mesh, int *E, int **ke, int **sedge) {
+    PetscErrorCode ierr;
+    const int   *ae, *as;
+    int         *ia, *ja, *first, n, j, k, l, p;
+    ierr = UMNodeAdjacency(mesh,&ia,&ja); CHKERRQ(ierr);
+    // first[n] = number of edges (a,b), a < b, with a < n
+    ierr = PetscMalloc1(mesh->N+1,&first); CHKERRQ(ierr);
+    first[0] = 0;
+    for (n = 0; n < mesh->N; n++) {
+        first[n+1] = first[n];
+        for (j = ia[n]; j < ia[n+1]; j++)
+            if (ja[j] > n)
+                first[n+1]++;
+    }
+    *E = first[mesh->N];
+    ierr = PetscMalloc1(3*mesh->K,ke); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++)
+        for (l = 0; l < 3; l++)
+            (*ke)[3*k+l] = UMEdgeIndex(ia,ja,first,ae[3*k+l],ae[3*k+(l+1)%3]);
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    if (sedge) {
+        ierr = PetscMalloc1(mesh->P,sedge); CHKERRQ(ierr);
+        ierr = ISGetIndices(mesh->s,&as); CHKERRQ(ierr);
+        for (p = 0; p < mesh->P; p++) {
+            (*sedge)[p] = UMEdgeIndex(ia,ja,first,as[2*p],as[2*p+1]);
+            if ((*sedge)[p] < 0) {
+                SETERRQ1(PETSC_COMM_SELF,1,
+                         "boundary segment %d is not an edge of any element\n",p);
+            }
+        }
+        ierr = ISRestoreIndices(mesh->s,&as); CHKERRQ(ierr);
+    }
+    ierr = PetscFree(ia); CHKERRQ(ierr);
+    ierr = PetscFree(ja); CHKERRQ(ierr);
+    ierr = PetscFree(first); CHKERRQ(ierr);
+    return 0;
+}
+
+
+// endpoints ends[2*j],ends[2*j+1] of each edge j numbered by UMCreateEdges()
+static PetscErrorCode UMEdgeEnds(UM *mesh, int E, const int *ke, int **ends) {
+    PetscErrorCode ierr;
+    const int   *ae;
+    int         k, l;
+    ierr = PetscMalloc1(2*E,ends); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        for (l = 0; l < 3; l++) {
+            (*ends)[2*ke[3*k+l]+0] = ae[3*k+l];
+            (*ends)[2*ke[3*k+l]+1] = ae[3*k+(l+1)%3];
+        }
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    return 0;
+}
+
+/* Complete a refinement of coarse, given the Kf new elements fe (which fine
+takes).  Fine nodes are the coarse nodes, with the same indices, then the
+midpoint of each edge j with mid[j] >= 0, as node mid[j].  A midpoint is
+interior unless it splits a boundary segment; then it has the segment's flag
+(Neumann or Dirichlet), as do both halves of the segment.  The P1
+interpolation is the identity at coarse nodes and the average of the ends at
+midpoints; if decouple then entries between Dirichlet and other nodes are
+left out, as they are in the assembled Picard and Newton matrices.  */
+static PetscErrorCode UMRefineFinish(UM *coarse, int E, const int *ends,
+        const int *mid, const int *sedge, int Kf, int *fe, PetscBool decouple,
+        UM *fine, Mat *interp) {
+    PetscErrorCode ierr;
+    const Node  *aloc;
+    Node        *afloc;
+    const int   *abfn, *as, *abfs;
+    int         *fbfn, *fs, *fbfs, N = coarse->N, n, j, l, p, q, a, col[2], ncol;
+    double      v[2];
+
+    ierr = UMInitialize(fine); CHKERRQ(ierr);
+    fine->N = N;
+    for (j = 0; j < E; j++)
+        if (mid[j] >= 0)
+            fine->N++;
+    fine->K = Kf;
+    fine->P = coarse->P;
+    for (p = 0; p < coarse->P; p++)
+        if (mid[sedge[p]] >= 0)
+            fine->P++;
+
+    // nodes
+    ierr = PetscMalloc1(fine->N,&fbfn); CHKERRQ(ierr);
+    ierr = VecCreateSeq(PETSC_COMM_SELF,2*fine->N,&(fine->loc)); CHKERRQ(ierr);
+    ierr = VecGetArray(fine->loc,(double **)&afloc); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(coarse,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(coarse->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < N; n++) {
+        afloc[n] = aloc[n];
+        fbfn[n] = abfn[n];
+    }
+    for (j = 0; j < E; j++) {
+        if (mid[j] < 0)
+            continue;
+        afloc[mid[j]].x = 0.5 * (aloc[ends[2*j]].x + aloc[ends[2*j+1]].x);
+        afloc[mid[j]].y = 0.5 * (aloc[ends[2*j]].y + aloc[ends[2*j+1]].y);
+        fbfn[mid[j]] = 0;
+    }
+    ierr = ISRestoreIndices(coarse->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(coarse,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArray(fine->loc,(double **)&afloc); CHKERRQ(ierr);
+    ierr = PetscLogFlops(6.0 * (fine->N - N)); CHKERRQ(ierr);
+
+    // segments
+    ierr = PetscMalloc1(2*fine->P,&fs); CHKERRQ(ierr);
+    ierr = PetscMalloc1(fine->P,&fbfs); CHKERRQ(ierr);
+    ierr = ISGetIndices(coarse->s,&as); CHKERRQ(ierr);
+    ierr = ISGetIndices(coarse->bfs,&abfs); CHKERRQ(ierr);
+    q = 0;
+    for (p = 0; p < coarse->P; p++) {
+        j = sedge[p];
+        if (mid[j] >= 0) {
+            fs[2*q] = as[2*p];    fs[2*q+1] = mid[j];   fbfs[q++] = abfs[p];
+            fs[2*q] = mid[j];     fs[2*q+1] = as[2*p+1]; fbfs[q++] = abfs[p];
+            fbfn[mid[j]] = (abfs[p] == 2) ? 2 : 1;
+        } else {
+            fs[2*q] = as[2*p];    fs[2*q+1] = as[2*p+1]; fbfs[q++] = abfs[p];
+        }
+    }
+    ierr = ISRestoreIndices(coarse->bfs,&abfs); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(coarse->s,&as); CHKERRQ(ierr);
+
+    if (interp) {
+        ierr = MatCreateSeqAIJ(PETSC_COMM_SELF,fine->N,N,2,NULL,interp); CHKERRQ(ierr);
+        for (n = 0; n < N; n++) {
+            v[0] = 1.0;
+            ierr = MatSetValues(*interp,1,&n,1,&n,v,INSERT_VALUES); CHKERRQ(ierr);
+        }
+        for (j = 0; j < E; j++) {
+            if (mid[j] < 0)
+                continue;
+            n = mid[j];
+            ncol = 0;
+            for (l = 0; l < 2; l++) {
+                a = ends[2*j+l];
+                if (!decouple || ((fbfn[a] == 2) == (fbfn[n] == 2))) {
+                    col[ncol] = a;
+                    v[ncol++] = 0.5;
+                }
+            }
+            ierr = MatSetValues(*interp,1,&n,ncol,col,v,INSERT_VALUES); CHKERRQ(ierr);
+        }
+        ierr = MatAssemblyBegin(*interp,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+        ierr = MatAssemblyEnd(*interp,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    }
+
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,3*fine->K,fe,PETSC_OWN_POINTER,&(fine->e)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,fine->N,fbfn,PETSC_OWN_POINTER,&(fine->bfn)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,2*fine->P,fs,PETSC_OWN_POINTER,&(fine->s)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,fine->P,fbfs,PETSC_OWN_POINTER,&(fine->bfs)); CHKERRQ(ierr);
+    fine->Nown = fine->N;
+    fine->Nglobal = fine->N;
+    return 0;
+}
+
+// refinement needs the whole mesh:  before UMDistribute(), or after it on
+// one process
+static PetscErrorCode UMRefineCheck(UM *mesh) {
+    if (mesh->ltog && mesh->Nown != mesh->N) {
+        SETERRQ(PETSC_COMM_WORLD,1,"refine the whole mesh, before UMDistribute()\n");
+    }
+    if ((!mesh->loc) || (mesh->N == 0) || (!mesh->e) || (!mesh->s)) {
+        SETERRQ(PETSC_COMM_WORLD,2,"mesh not complete\n");
+    }
+    return 0;
+}
+
+/* Children of element (a,b,c), with midpoints m0 of ab, m1 of bc, m2 of ca,
+are (a,m0,m2), (m0,b,m1), (m2,m1,c), and (m0,m1,m2), which have the
+orientation of the parent.  */
+PetscErrorCode UMRefineUniform(UM *coarse, UM *fine, Mat *interp) {
+    PetscErrorCode ierr;
+    const int   *ae;
+    int         *ke, *sedge, *ends, *mid, *fe, N = coarse->N, E, j, k, l, m[3];
+
+    ierr = UMRefineCheck(coarse); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Refine,0,0,0,0); CHKERRQ(ierr);
+    ierr = UMCreateEdges(coarse,&E,&ke,&sedge); CHKERRQ(ierr);
+    ierr = UMEdgeEnds(coarse,E,ke,&ends); CHKERRQ(ierr);
+    ierr = PetscMalloc1(E,&mid); CHKERRQ(ierr);
+    for (j = 0; j < E; j++)
+        mid[j] = N + j;
+    ierr = PetscMalloc1(12*coarse->K,&fe); CHKERRQ(ierr);
+    ierr = ISGetIndices(coarse->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < coarse->K; k++) {
+        for (l = 0; l < 3; l++)
+            m[l] = mid[ke[3*k+l]];
+        fe[12*k+0]  = ae[3*k+0];  fe[12*k+1]  = m[0];  fe[12*k+2]  = m[2];
+        fe[12*k+3]  = m[0];  fe[12*k+4]  = ae[3*k+1];  fe[12*k+5]  = m[1];
+        fe[12*k+6]  = m[2];  fe[12*k+7]  = m[1];  fe[12*k+8]  = ae[3*k+2];
+        fe[12*k+9]  = m[0];  fe[12*k+10] = m[1];  fe[12*k+11] = m[2];
+    }
+    ierr = ISRestoreIndices(coarse->e,&ae); CHKERRQ(ierr);
+    ierr = UMRefineFinish(coarse,E,ends,mid,sedge,4*coarse->K,fe,PETSC_TRUE,
+                          fine,interp); CHKERRQ(ierr);
+    ierr = PetscFree(mid); CHKERRQ(ierr);
+    ierr = PetscFree(ends); CHKERRQ(ierr);
+    ierr = PetscFree(ke); CHKERRQ(ierr);
+    ierr = PetscFree(sedge); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Refine,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+/* Longest-edge bisection with closure.  The longest edge of each marked
+element is marked, and then the longest edge of any element with a marked
+edge, until no more change; this keeps the fine mesh conforming.  With local
+nodes rotated so that (v0,v1) is the longest edge, an element is bisected
+into (v0,mL,v2) and (mL,v1,v2), and these are bisected again at the midpoints
+of (v2,v0) and (v1,v2), respectively, if those edges are marked.  */
+PetscErrorCode UMRefineMarked(UM *coarse, const PetscBool *marked, UM *fine,
+                              Mat *interp) {
+    PetscErrorCode ierr;
+    const Node  *aloc;
+    const int   *ae;
+    int         *ke, *sedge, *ends, *mid, *longest, *fe,
+                N = coarse->N, E, M, Kf, j, k, l, r, v0, v1, v2, mL, mA, mB;
+    double      dx, dy, len, maxlen;
+    PetscBool   changed;
+
+    ierr = UMRefineCheck(coarse); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Refine,0,0,0,0); CHKERRQ(ierr);
+    ierr = UMCreateEdges(coarse,&E,&ke,&sedge); CHKERRQ(ierr);
+    ierr = UMEdgeEnds(coarse,E,ke,&ends); CHKERRQ(ierr);
+
+    // local index of longest edge of each element; ties go to lower edge index
+    ierr = PetscMalloc1(coarse->K,&longest); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(coarse,&aloc); CHKERRQ(ierr);
+    for (k = 0; k < coarse->K; k++) {
+        maxlen = -1.0;
+        for (l = 0; l < 3; l++) {
+            j = ke[3*k+l];
+            dx = aloc[ends[2*j+1]].x - aloc[ends[2*j]].x;
+            dy = aloc[ends[2*j+1]].y - aloc[ends[2*j]].y;
+            len = dx * dx + dy * dy;
+            if (len > maxlen || (len == maxlen && j < ke[3*k+longest[k]])) {
+                maxlen = len;
+                longest[k] = l;
+            }
+        }
+    }
+    ierr = UMRestoreNodeCoordArrayRead(coarse,&aloc); CHKERRQ(ierr);
+    ierr = PetscLogFlops(15.0 * coarse->K); CHKERRQ(ierr);
+
+    // mark edges, with closure; mid[j] is 1 for a marked edge, else -1
+    ierr = PetscMalloc1(E,&mid); CHKERRQ(ierr);
+    for (j = 0; j < E; j++)
+        mid[j] = -1;
+    for (k = 0; k < coarse->K; k++)
+        if (marked[k])
+            mid[ke[3*k+longest[k]]] = 1;
+    do {
+        changed = PETSC_FALSE;
+        for (k = 0; k < coarse->K; k++) {
+            if (mid[ke[3*k+longest[k]]] > 0)
+                continue;
+            for (l = 0; l < 3; l++) {
+                if (mid[ke[3*k+l]] > 0) {
+                    mid[ke[3*k+longest[k]]] = 1;
+                    changed = PETSC_TRUE;
+                    break;
+                }
+            }
+        }
+    } while (changed);
+
+    // number the midpoints, and count the new elements:  an element with M
+    // marked edges has M+1 children
+    M = 0;
+    for (j = 0; j < E; j++)
+        if (mid[j] > 0)
+            mid[j] = N + M++;
+    Kf = coarse->K;
+    for (k = 0; k < coarse->K; k++)
+        for (l = 0; l < 3; l++)
+            if (mid[ke[3*k+l]] >= 0)
+                Kf++;
+
+    ierr = PetscMalloc1(3*Kf,&fe); CHKERRQ(ierr);
+    ierr = ISGetIndices(coarse->e,&ae); CHKERRQ(ierr);
+    Kf = 0;
+    for (k = 0; k < coarse->K; k++) {
+        r = longest[k];
+        v0 = ae[3*k+r];
+        v1 = ae[3*k+(r+1)%3];
+        v2 = ae[3*k+(r+2)%3];
+        mL = mid[ke[3*k+r]];
+        mA = mid[ke[3*k+(r+1)%3]];
+        mB = mid[ke[3*k+(r+2)%3]];
+        if (mL < 0) {
+            fe[3*Kf+0] = v0;  fe[3*Kf+1] = v1;  fe[3*Kf+2] = v2;  Kf++;
+            continue;
+        }
+        if (mB < 0) {
+            fe[3*Kf+0] = v0;  fe[3*Kf+1] = mL;  fe[3*Kf+2] = v2;  Kf++;
+        } else {
+            fe[3*Kf+0] = v0;  fe[3*Kf+1] = mL;  fe[3*Kf+2] = mB;  Kf++;
+            fe[3*Kf+0] = mL;  fe[3*Kf+1] = v2;  fe[3*Kf+2] = mB;  Kf++;
+        }
+        if (mA < 0) {
+            fe[3*Kf+0] = mL;  fe[3*Kf+1] = v1;  fe[3*Kf+2] = v2;  Kf++;
+        } else {
+            fe[3*Kf+0] = mL;  fe[3*Kf+1] = v1;  fe[3*Kf+2] = mA;  Kf++;
+            fe[3*Kf+0] = mL;  fe[3*Kf+1] = mA;  fe[3*Kf+2] = v2;  Kf++;
+        }
+    }
+    ierr = ISRestoreIndices(coarse->e,&ae); CHKERRQ(ierr);
+    ierr = UMRefineFinish(coarse,E,ends,mid,sedge,Kf,fe,PETSC_FALSE,
+                          fine,interp); CHKERRQ(ierr);
+    ierr = PetscFree(longest); CHKERRQ(ierr);
+    ierr = PetscFree(mid); CHKERRQ(ierr);
+    ierr = PetscFree(ends); CHKERRQ(ierr);
+    ierr = PetscFree(ke); CHKERRQ(ierr);
+    ierr = PetscFree(sedge); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Refine,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+// Reverse Cuthill-McKee: breadth-first search from a low-degree node in each
+// connected component, visiting neighbors in order of increasing degree;
+// order[j] is the old index of new node j
+static PetscErrorCode UMOrderingRCM(UM *mesh, int *order) {
+    PetscErrorCode ierr;
+    int  *ia, *ja, *deg, *nbr, *visited, N = mesh->N,
+         n, j, head, tail, start, nn, cnt, tmp;
+    ierr = UMNodeAdjacency(mesh,&ia,&ja); CHKERRQ(ierr);
+    ierr = PetscMalloc1(N,&deg); CHKERRQ(ierr);
+    ierr = PetscCalloc1(N,&visited); CHKERRQ(ierr);
+    ierr = PetscMalloc1(N,&nbr); CHKERRQ(ierr);
+    for (n = 0; n < N; n++)
+        deg[n] = ia[n+1] - ia[n];
+    tail = 0;
+    while (tail < N) {
+        // start of next component:  unvisited node of minimum degree
+        start = -1;
+        for (n = 0; n < N; n++)
+            if (!visited[n] && (start < 0 || deg[n] < deg[start]))
+                start = n;
+        visited[start] = 1;
+        order[tail++] = start;
+        head = tail - 1;
+        while (head < tail) {
+            nn = order[head++];
+            cnt = 0;
+            for (j = ia[nn]; j < ia[nn+1]; j++) {
+                if (!visited[ja[j]]) {
+                    visited[ja[j]] = 1;
+                    nbr[cnt++] = ja[j];
+                }
+            }
+            // insertion sort by degree; cnt is small
+            for (j = 1; j < cnt; j++) {
+                tmp = nbr[j];
+                n = j - 1;
+                while (n >= 0 && deg[nbr[n]] > deg[tmp]) {
+                    nbr[n+1] = nbr[n];
+                    n--;
+                }
+                nbr[n+1] = tmp;
+            }
+            for (j = 0; j < cnt; j++)
+                order[tail++] = nbr[j];
+        }
+    }
+    for (j = 0; j < N / 2; j++) {  // reverse
+        tmp = order[j];
+        order[j] = order[N-1-j];
+        order[N-1-j] = tmp;
+    }
+    ierr = PetscFree(ia); CHKERRQ(ierr);
+    ierr = PetscFree(ja); CHKERRQ(ierr);
+    ierr = PetscFree(deg); CHKERRQ(ierr);
+    ierr = PetscFree(visited); CHKERRQ(ierr);
+    ierr = PetscFree(nbr); CHKERRQ(ierr);
+    return 0;
+}
+
+// index of cell (x,y) along the Hilbert curve filling a 2^b by 2^b grid
+static int HilbertIndex(int b, int x, int y) {
+    int s, rx, ry, d = 0, tmp;
+    for (s = 1 << (b-1); s > 0; s /= 2) {
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {  // rotate quadrant
+            if (rx == 1) {
+                x = s-1 - x;
+                y = s-1 - y;
+            }
+            tmp = x;
+            x = y;
+            y = tmp;
+        }
+    }
+    return d;
+}
+
+// sort nodes by their position along a Hilbert curve through the bounding
+// box, on a 2^15 by 2^15 grid so that the index fits in an int
+static PetscErrorCode UMOrderingHilbert(UM *mesh, int *order) {
+    PetscErrorCode ierr;
+    const int  b = 15, M = (1 << 15) - 1;
+    const Node *aloc;
+    int        *key, n;
+    double     xmin, xmax, ymin, ymax, scale;
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    xmin = xmax = aloc[0].x;
+    ymin = ymax = aloc[0].y;
+    for (n = 1; n < mesh->N; n++) {
+        xmin = PetscMin(xmin,aloc[n].x);
+        xmax = PetscMax(xmax,aloc[n].x);
+        ymin = PetscMin(ymin,aloc[n].y);
+        ymax = PetscMax(ymax,aloc[n].y);
+    }
+    scale = PetscMax(xmax - xmin, ymax - ymin);
+    scale = (scale > 0.0) ? M / scale : 0.0;
+    ierr = PetscMalloc1(mesh->N,&key); CHKERRQ(ierr);
+    for (n = 0; n < mesh->N; n++) {
+        key[n] = HilbertIndex(b,(int)((aloc[n].x - xmin) * scale),
+                                (int)((aloc[n].y - ymin) * scale));
+        order[n] = n;
+    }
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = PetscSortIntWithArray(mesh->N,key,order); CHKERRQ(ierr);
+    ierr = PetscFree(key); CHKERRQ(ierr);
+    return 0;
+}
+
+/* Nodes are renumbered in the given order.  Each element triple is then
+rotated (which keeps its orientation) so its lowest-numbered node is first,
+and elements are sorted by first node, with a counting sort.  Segments keep
+their order.  app records the original (file) index of each node.  */
+PetscErrorCode UMReorder(UM *mesh, UMReorderType method) {
+    PetscErrorCode ierr;
+    const Node   *aloc;
+    Node         *anewloc;
+    Vec          newloc;
+    const int    *ae, *abfn, *as, *aapp = NULL;
+    int          *order, *newnum, *newe, *newbfn, *news, *newapp, *cnt,
+                 N = mesh->N, n, k, l, p, first, pos;
+
+    if (method == UM_REORDER_NONE)
+        return 0;
+    if (mesh->ltog) {
+        SETERRQ(PETSC_COMM_WORLD,1,"reorder the whole mesh, before UMDistribute()\n");
+    }
+    if ((!mesh->loc) || (mesh->N == 0) || (!mesh->e) || (!mesh->s)) {
+        SETERRQ(PETSC_COMM_WORLD,2,"mesh not complete\n");
+    }
+    ierr = PetscLogEventBegin(UM_Reorder,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscMalloc1(N,&order); CHKERRQ(ierr);
+    switch (method) {
+        case UM_REORDER_RCM :
+            ierr = UMOrderingRCM(mesh,order); CHKERRQ(ierr);
+            break;
+        case UM_REORDER_HILBERT :
+            ierr = UMOrderingHilbert(mesh,order); CHKERRQ(ierr);
+            break;
+        default :
+            SETERRQ(PETSC_COMM_WORLD,3,"unknown reordering method\n");
+    }
+    ierr = PetscMalloc1(N,&newnum); CHKERRQ(ierr);
+    for (n = 0; n < N; n++)
+        newnum[order[n]] = n;
+
+    // nodes
+    if (mesh->app) {
+        ierr = ISGetIndices(mesh->app,&aapp); CHKERRQ(ierr);
+    }
+    ierr = PetscMalloc1(N,&newbfn); CHKERRQ(ierr);
+    ierr = PetscMalloc1(N,&newapp); CHKERRQ(ierr);
+    ierr = VecCreateSeq(PETSC_COMM_SELF,2*N,&newloc); CHKERRQ(ierr);
+    ierr = VecGetArray(newloc,(double **)&anewloc); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < N; n++) {
+        anewloc[newnum[n]] = aloc[n];
+        newbfn[newnum[n]] = abfn[n];
+        newapp[newnum[n]] = (aapp) ? aapp[n] : n;
+    }
+    ierr = ISRestoreIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArray(newloc,(double **)&anewloc); CHKERRQ(ierr);
+    if (mesh->app) {
+        ierr = ISRestoreIndices(mesh->app,&aapp); CHKERRQ(ierr);
+    }
+    if (mesh->part) {
+        int *newpart;
+        ierr = PetscMalloc1(N,&newpart); CHKERRQ(ierr);
+        for (n = 0; n < N; n++)
+            newpart[newnum[n]] = mesh->part[n];
+        ierr = PetscFree(mesh->part); CHKERRQ(ierr);
+        mesh->part = newpart;
+    }
+
+    // elements
+    ierr = PetscCalloc1(N+1,&cnt); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        first = PetscMin(newnum[ae[3*k]],PetscMin(newnum[ae[3*k+1]],newnum[ae[3*k+2]]));
+        cnt[first+1]++;
+    }
+    for (n = 0; n < N; n++)
+        cnt[n+1] += cnt[n];
+    ierr = PetscMalloc1(3*mesh->K,&newe); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        first = PetscMin(newnum[ae[3*k]],PetscMin(newnum[ae[3*k+1]],newnum[ae[3*k+2]]));
+        for (l = 0; l < 3; l++)
+            if (newnum[ae[3*k+l]] == first)
+                break;
+        pos = cnt[first]++;
+        newe[3*pos+0] = newnum[ae[3*k+l]];
+        newe[3*pos+1] = newnum[ae[3*k+(l+1)%3]];
+        newe[3*pos+2] = newnum[ae[3*k+(l+2)%3]];
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = PetscFree(cnt); CHKERRQ(ierr);
+
+    // segments
+    ierr = PetscMalloc1(2*mesh->P,&news); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->s,&as); CHKERRQ(ierr);
+    for (p = 0; p < 2*mesh->P; p++)
+        news[p] = newnum[as[p]];
+    ierr = ISRestoreIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = PetscFree(order); CHKERRQ(ierr);
+    ierr = PetscFree(newnum); CHKERRQ(ierr);
+
+    // replace; bfs is unchanged
+    VecDestroy(&(mesh->loc));
+    ISDestroy(&(mesh->e));
+    ISDestroy(&(mesh->bfn));
+    ISDestroy(&(mesh->s));
+    ISDestroy(&(mesh->app));
+    UMGeometryDestroy(&(mesh->geom));  // element order changed
+    PetscFree(mesh->colorptr);
+    PetscFree(mesh->colorelt);
+    mesh->ncolors = 0;
+    mesh->loc = newloc;
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,3*mesh->K,newe,PETSC_OWN_POINTER,&(mesh->e)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,N,newbfn,PETSC_OWN_POINTER,&(mesh->bfn)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,2*mesh->P,news,PETSC_OWN_POINTER,&(mesh->s)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,N,newapp,PETSC_OWN_POINTER,&(mesh->app)); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Reorder,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+/* The node graph of the whole mesh is handed to MatPartitioning (use
+-mat_partitioning_type parmetis for a good partition; the default may just
+keep blocks of the file order).  The result is gathered so every process
+has the owner of every node.  */
+PetscErrorCode UMPartition(UM *mesh, MPI_Comm comm) {
+    PetscErrorCode  ierr;
+    PetscMPIInt     rank, size;
+    MatPartitioning part;
+    Mat             adj;
+    IS              ispart, ispartall;
+    const int       *apart;
+    int             *ia, *ja, *aia, *aja, N = mesh->N, rs, re, n;
+
+    if (mesh->ltog) {
+        SETERRQ(PETSC_COMM_WORLD,1,"mesh already distributed\n");
+    }
+    ierr = MPI_Comm_rank(comm,&rank); CHKERRQ(ierr);
+    ierr = MPI_Comm_size(comm,&size); CHKERRQ(ierr);
+    if (mesh->part && mesh->nparts == size)
+        return 0;  // e.g. from UMReadCompact()
+    ierr = PetscFree(mesh->part); CHKERRQ(ierr);
+    if (size == 1) {
+        ierr = PetscCalloc1(N,&(mesh->part)); CHKERRQ(ierr);
+        mesh->nparts = 1;
+        return 0;
+    }
+
+    ierr = PetscLogEventBegin(UM_Partition,0,0,0,0); CHKERRQ(ierr);
+    // partition node graph; this process gives a block of rows
+    ierr = UMNodeAdjacency(mesh,&ia,&ja); CHKERRQ(ierr);
+    rs = (int)(((PetscInt64)rank * N) / size);
+    re = (int)(((PetscInt64)(rank+1) * N) / size);
+    ierr = PetscMalloc1(re-rs+1,&aia); CHKERRQ(ierr);
+    ierr = PetscMalloc1(ia[re]-ia[rs],&aja); CHKERRQ(ierr);
+    for (n = rs; n <= re; n++)
+        aia[n-rs] = ia[n] - ia[rs];
+    for (n = ia[rs]; n < ia[re]; n++)
+        aja[n-ia[rs]] = ja[n];
+    ierr = PetscFree(ia); CHKERRQ(ierr);
+    ierr = PetscFree(ja); CHKERRQ(ierr);
+    ierr = MatCreateMPIAdj(comm,re-rs,N,aia,aja,NULL,&adj); CHKERRQ(ierr);  // takes aia,aja
+    ierr = MatPartitioningCreate(comm,&part); CHKERRQ(ierr);
+    ierr = MatPartitioningSetAdjacency(part,adj); CHKERRQ(ierr);
+    ierr = MatPartitioningSetFromOptions(part); CHKERRQ(ierr);
+    ierr = MatPartitioningApply(part,&ispart); CHKERRQ(ierr);
+    ierr = MatPartitioningDestroy(&part); CHKERRQ(ierr);
+    ierr = MatDestroy(&adj); CHKERRQ(ierr);
+    ierr = ISAllGather(ispart,&ispartall); CHKERRQ(ierr);
+    ISDestroy(&ispart);
+    ierr = PetscMalloc1(N,&(mesh->part)); CHKERRQ(ierr);
+    ierr = ISGetIndices(ispartall,&apart); CHKERRQ(ierr);
+    ierr = PetscMemcpy(mesh->part,apart,N*sizeof(int)); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(ispartall,&apart); CHKERRQ(ierr);
+    ISDestroy(&ispartall);
+    mesh->nparts = size;
+    ierr = PetscLogEventEnd(UM_Partition,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+/* Owned nodes are renumbered contiguously on each process, in the order of
+the whole mesh, as ISPartitioningToNumbering() would do.  The local mesh has
+the owned nodes first, in global order, then ghosts, in global order.
+Elements and boundary segments which touch an owned node are kept, so each
+process can assemble all rows it owns without communication except of ghost
+values.  */
+PetscErrorCode UMDistribute(UM *mesh, MPI_Comm comm) {
+    PetscErrorCode  ierr;
+    PetscMPIInt     rank, size;
+    const int       *apart, *anum, *ae, *abfn, *as, *abfs, *aapp = NULL, *en;
+    const Node      *aloc;
+    Node            *anewloc;
+    Vec             newloc;
+    int             *offset, *num, *local, *ghost, *gkey, *ltogidx,
+                    *newe, *newbfn, *news, *newbfs, *newapp,
+                    N = mesh->N, n, k, p, l, G, Nloc, Kloc, Ploc, gstart, mine;
+
+    if (mesh->ltog) {
+        SETERRQ(PETSC_COMM_WORLD,1,"mesh already distributed\n");
+    }
+    if ((!mesh->loc) || (mesh->N == 0) || (!mesh->e) || (!mesh->s)) {
+        SETERRQ(PETSC_COMM_WORLD,2,
+                "mesh not complete; call UMReadNodes() and UMReadISs() first\n");
+    }
+    ierr = MPI_Comm_rank(comm,&rank); CHKERRQ(ierr);
+    ierr = MPI_Comm_size(comm,&size); CHKERRQ(ierr);
+    ierr = PetscLogEventBegin(UM_Distribute,0,0,0,0); CHKERRQ(ierr);
+    mesh->Nglobal = N;
+    if (size == 1) {
+        IS  isall;
+        mesh->Nown = N;
+        ierr = ISCreateStride(PETSC_COMM_SELF,N,0,1,&isall); CHKERRQ(ierr);
+        ierr = ISLocalToGlobalMappingCreateIS(isall,&(mesh->ltog)); CHKERRQ(ierr);
+        ISDestroy(&isall);
+        ierr = PetscLogEventEnd(UM_Distribute,0,0,0,0); CHKERRQ(ierr);
+        return 0;
+    }
+
+    // owner of each node of the whole mesh, and new (global) numbering:
+    // owned nodes are numbered contiguously on each process, in mesh order
+    ierr = UMPartition(mesh,comm); CHKERRQ(ierr);
+    apart = mesh->part;
+    ierr = PetscCalloc1(size+1,&offset); CHKERRQ(ierr);
+    for (n = 0; n < N; n++)
+        offset[apart[n]+1]++;
+    for (p = 0; p < size; p++)
+        offset[p+1] += offset[p];
+    ierr = PetscMalloc1(N,&num); CHKERRQ(ierr);
+    for (n = 0; n < N; n++)
+        num[n] = offset[apart[n]]++;
+    ierr = PetscFree(offset); CHKERRQ(ierr);
+    anum = num;
+
+    // local[n] is local index of node n of whole mesh, or negative if absent
+    ierr = PetscMalloc1(N,&local); CHKERRQ(ierr);
+    mesh->Nown = 0;
+    gstart = N;
+    for (n = 0; n < N; n++) {
+        local[n] = -1;
+        if (apart[n] == rank) {
+            mesh->Nown++;
+            gstart = PetscMin(gstart,anum[n]);
+        }
+    }
+    for (n = 0; n < N; n++)
+        if (apart[n] == rank)
+            local[n] = anum[n] - gstart;
+
+    // elements touching owned nodes; their other nodes are ghosts
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    Kloc = 0;
+    G = 0;
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        if (apart[en[0]] == rank || apart[en[1]] == rank || apart[en[2]] == rank) {
+            Kloc++;
+            for (l = 0; l < 3; l++) {
+                if (local[en[l]] == -1) {
+                    local[en[l]] = -2;  // mark as ghost
+                    G++;
+                }
+            }
+        }
+    }
+    ierr = PetscMalloc1(G,&ghost); CHKERRQ(ierr);
+    ierr = PetscMalloc1(G,&gkey); CHKERRQ(ierr);
+    G = 0;
+    for (n = 0; n < N; n++) {
+        if (local[n] == -2) {
+            ghost[G] = n;
+            gkey[G] = anum[n];
+            G++;
+        }
+    }
+    ierr = PetscSortIntWithArray(G,gkey,ghost); CHKERRQ(ierr);
+    for (n = 0; n < G; n++)
+        local[ghost[n]] = mesh->Nown + n;
+    Nloc = mesh->Nown + G;
+
+    // local node data
+    if (mesh->app) {
+        ierr = ISGetIndices(mesh->app,&aapp); CHKERRQ(ierr);
+    }
+    ierr = PetscMalloc1(Nloc,&ltogidx); CHKERRQ(ierr);
+    ierr = PetscMalloc1(Nloc,&newapp); CHKERRQ(ierr);
+    ierr = PetscMalloc1(Nloc,&newbfn); CHKERRQ(ierr);
+    ierr = VecCreateSeq(PETSC_COMM_SELF,2*Nloc,&newloc); CHKERRQ(ierr);
+    ierr = VecGetArray(newloc,(double **)&anewloc); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < N; n++) {
+        if (local[n] >= 0) {
+            ltogidx[local[n]] = anum[n];
+            newapp[local[n]] = (aapp) ? aapp[n] : n;
+            newbfn[local[n]] = abfn[n];
+            anewloc[local[n]] = aloc[n];
+        }
+    }
+    ierr = ISRestoreIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArray(newloc,(double **)&anewloc); CHKERRQ(ierr);
+    if (mesh->app) {
+        ierr = ISRestoreIndices(mesh->app,&aapp); CHKERRQ(ierr);
+    }
+
+    // local elements
+    ierr = PetscMalloc1(3*Kloc,&newe); CHKERRQ(ierr);
+    Kloc = 0;
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        if (apart[en[0]] == rank || apart[en[1]] == rank || apart[en[2]] == rank) {
+            for (l = 0; l < 3; l++)
+                newe[3*Kloc+l] = local[en[l]];
+            Kloc++;
+        }
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+
+    // local boundary segments; each is a side of a local element
+    ierr = ISGetIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    Ploc = 0;
+    for (p = 0; p < mesh->P; p++)
+        if (apart[as[2*p]] == rank || apart[as[2*p+1]] == rank)
+            Ploc++;
+    ierr = PetscMalloc1(2*Ploc,&news); CHKERRQ(ierr);
+    ierr = PetscMalloc1(Ploc,&newbfs); CHKERRQ(ierr);
+    Ploc = 0;
+    for (p = 0; p < mesh->P; p++) {
+        mine = (apart[as[2*p]] == rank || apart[as[2*p+1]] == rank);
+        if (!mine)
+            continue;
+        if (local[as[2*p]] < 0 || local[as[2*p+1]] < 0) {
+            SETERRQ1(PETSC_COMM_SELF,3,
+                     "boundary segment %d is not a side of any element\n",p);
+        }
+        news[2*Ploc+0] = local[as[2*p+0]];
+        news[2*Ploc+1] = local[as[2*p+1]];
+        newbfs[Ploc] = abfs[p];
+        Ploc++;
+    }
+    ierr = ISRestoreIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    ierr = PetscFree(num); CHKERRQ(ierr);
+    ierr = PetscFree(local); CHKERRQ(ierr);
+    ierr = PetscFree(ghost); CHKERRQ(ierr);
+    ierr = PetscFree(gkey); CHKERRQ(ierr);
+
+    // replace whole mesh by local mesh
+    VecDestroy(&(mesh->loc));
+    ISDestroy(&(mesh->e));
+    ISDestroy(&(mesh->bfn));
+    ISDestroy(&(mesh->s));
+    ISDestroy(&(mesh->bfs));
+    ISDestroy(&(mesh->app));
+    UMGeometryDestroy(&(mesh->geom));  // was for whole mesh
+    PetscFree(mesh->colorptr);
+    PetscFree(mesh->colorelt);
+    mesh->ncolors = 0;
+    ierr = PetscFree(mesh->part); CHKERRQ(ierr);
+    mesh->nparts = 0;
+    mesh->loc = newloc;
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,3*Kloc,newe,PETSC_OWN_POINTER,&(mesh->e)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,Nloc,newbfn,PETSC_OWN_POINTER,&(mesh->bfn)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,2*Ploc,news,PETSC_OWN_POINTER,&(mesh->s)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,Ploc,newbfs,PETSC_OWN_POINTER,&(mesh->bfs)); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,Nloc,newapp,PETSC_OWN_POINTER,&(mesh->app)); CHKERRQ(ierr);
+    ierr = ISLocalToGlobalMappingCreate(comm,1,Nloc,ltogidx,PETSC_OWN_POINTER,
+                                        &(mesh->ltog)); CHKERRQ(ierr);
+    if (mesh->map) {  // whole mesh no longer used
+        munmap(mesh->map,mesh->maplen);
+        mesh->map = NULL;
+    }
+    mesh->N = Nloc;
+    mesh->K = Kloc;
+    mesh->P = Ploc;
+    ierr = PetscLogEventEnd(UM_Distribute,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+PetscErrorCode UMCreateGlobalToLocal(UM *mesh, Vec u, Vec *uloc, VecScatter *ctx) {
+    PetscErrorCode ierr;
+    const int   *idx;
+    IS          isg;
+    if (!mesh->ltog) {
+        SETERRQ(PETSC_COMM_WORLD,1,"local-to-global map not created; call UMDistribute() first\n");
+    }
+    ierr = ISLocalToGlobalMappingGetIndices(mesh->ltog,&idx); CHKERRQ(ierr);
+    ierr = ISCreateGeneral(PETSC_COMM_SELF,mesh->N,idx,PETSC_COPY_VALUES,&isg); CHKERRQ(ierr);
+    ierr = ISLocalToGlobalMappingRestoreIndices(mesh->ltog,&idx); CHKERRQ(ierr);
+    ierr = VecCreateSeq(PETSC_COMM_SELF,mesh->N,uloc); CHKERRQ(ierr);
+    ierr = VecScatterCreate(u,isg,*uloc,NULL,ctx); CHKERRQ(ierr);
+    ISDestroy(&isg);
+    return 0;
+}
+
+
+/* Greedy coloring:  element k gets the lowest color not already used by an
+element sharing one of its nodes.  used[n] is a bit mask of the colors at
+node n.  The number of colors is at most one more than the largest number of
+elements sharing a node with any one element, which can be nearly three
+times the largest number of elements at a node.  If more than 64 colors are
+needed then no coloring is created (colorptr stays NULL) and callers
+assemble without it.  */
+PetscErrorCode UMCreateElementColoring(UM *mesh) {
+    PetscErrorCode ierr;
+    const int     *ae, *en;
+    unsigned long long *used, mask;
+    int           *color, k, c;
+    if ((mesh->K == 0) || (mesh->e == NULL)) {
+        SETERRQ(PETSC_COMM_WORLD,1,
+                "number of elements unknown; call UMReadElements() first\n");
+    }
+    if (mesh->colorptr)
+        return 0;
+    ierr = PetscLogEventBegin(UM_Coloring,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscCalloc1(mesh->N,&used); CHKERRQ(ierr);
+    ierr = PetscMalloc1(mesh->K,&color); CHKERRQ(ierr);
+    mesh->ncolors = 0;
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        mask = used[en[0]] | used[en[1]] | used[en[2]];
+        for (c = 0; c < 64; c++)
+            if (!(mask & (1ULL << c)))
+                break;
+        if (c == 64) {
+            ierr = PetscInfo1(NULL,"element %d needs more than 64 colors; no coloring created\n",k); CHKERRQ(ierr);
+            ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+            ierr = PetscFree(used); CHKERRQ(ierr);
+            ierr = PetscFree(color); CHKERRQ(ierr);
+            mesh->ncolors = 0;
+            ierr = PetscLogEventEnd(UM_Coloring,0,0,0,0); CHKERRQ(ierr);
+            return 0;
+        }
+        color[k] = c;
+        used[en[0]] |= 1ULL << c;
+        used[en[1]] |= 1ULL << c;
+        used[en[2]] |= 1ULL << c;
+        mesh->ncolors = PetscMax(mesh->ncolors,c+1);
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    // group elements by color, in element order within each color
+    ierr = PetscCalloc1(mesh->ncolors+1,&(mesh->colorptr)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(mesh->K,&(mesh->colorelt)); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++)
+        mesh->colorptr[color[k]+1]++;
+    for (c = 0; c < mesh->ncolors; c++)
+        mesh->colorptr[c+1] += mesh->colorptr[c];
+    for (k = 0; k < mesh->K; k++)
+        mesh->colorelt[mesh->colorptr[color[k]]++] = k;
+    for (c = mesh->ncolors; c > 0; c--)  // undo the shift from filling
+        mesh->colorptr[c] = mesh->colorptr[c-1];
+    mesh->colorptr[0] = 0;
+    ierr = PetscFree(used); CHKERRQ(ierr);
+    ierr = PetscFree(color); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Coloring,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
+
+
+// same formulas as in FormFunction() in unfem.c; the mesh is static so
+// these need only be computed once
+PetscErrorCode UMCreateGeometry(UM *mesh, int quaddegree) {
+    PetscErrorCode  ierr;
+    const double    dchi[3][2] = {{-1.0,-1.0},{ 1.0, 0.0},{ 0.0, 1.0}};
+    Quad2DTri       q;
+    UMGeometry      *g;
+    const int       *ae, *en;
+    const Node      *aloc;
+    double          dx1, dx2, dy1, dy2, detJ;
+    int             k, l, r;
+
+    if (mesh->geom) {
+        if (mesh->geom->quaddegree == quaddegree)
+            return 0;
+        UMGeometryDestroy(&(mesh->geom));
+    }
+    if ((quaddegree < 1) || (quaddegree > 5)) {
+        SETERRQ1(PETSC_COMM_WORLD,2,"quadrature degree %d not available\n",quaddegree);
+    }
+    q = symmgauss[quaddegree-1];
+    ierr = PetscLogEventBegin(UM_Geometry,0,0,0,0); CHKERRQ(ierr);
+    ierr = PetscNew(&g); CHKERRQ(ierr);
+    g->quaddegree = quaddegree;
+    ierr = PetscMalloc1(mesh->K,&(g->absdetJ)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(3*mesh->K,&(g->gx)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(3*mesh->K,&(g->gy)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(q.n*mesh->K,&(g->xq)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(q.n*mesh->K,&(g->yq)); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < mesh->K; k++) {
+        en = ae + 3*k;
+        dx1 = aloc[en[1]].x - aloc[en[0]].x;
+        dx2 = aloc[en[2]].x - aloc[en[0]].x;
+        dy1 = aloc[en[1]].y - aloc[en[0]].y;
+        dy2 = aloc[en[2]].y - aloc[en[0]].y;
+        detJ = dx1 * dy2 - dx2 * dy1;
+        g->absdetJ[k] = PetscAbs(detJ);
+        for (l = 0; l < 3; l++) {
+            g->gx[3*k+l] = ( dy2 * dchi[l][0] - dy1 * dchi[l][1]) / detJ;
+            g->gy[3*k+l] = (-dx2 * dchi[l][0] + dx1 * dchi[l][1]) / detJ;
+        }
+        for (r = 0; r < q.n; r++) {
+            g->xq[q.n*k+r] = aloc[en[0]].x + dx1 * q.xi[r] + dx2 * q.eta[r];
+            g->yq[q.n*k+r] = aloc[en[0]].y + dy1 * q.xi[r] + dy2 * q.eta[r];
+        }
+    }
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    mesh->geom = g;
+    ierr = PetscLogFlops((31.0 + 8.0 * q.n) * mesh->K); CHKERRQ(ierr);
+    ierr = PetscLogEventEnd(UM_Geometry,0,0,0,0); CHKERRQ(ierr);
+    return 0;
+}
@@ -7,6 +7,20 @@ typedef struct {
     double   x,y;
 } Node;
 
+// optional cache of element geometry; see UMCreateGeometry()
+typedef struct {
+    int      quaddegree;// degree of symmgauss[] rule for xq,yq
+    double   *absdetJ,  // |det J| of map from reference element; length K
+             *gx, *gy,  // hat function gradients:  node l of element k
+                        //     has grad psi = (gx[3*k+l],gy[3*k+l])
+             *xq, *yq;  // quadrature points:  point r of element k is at
+                        //     (xq[n*k+r],yq[n*k+r]) where n = number of points
+    PetscBool mapped;   // arrays are in a file mapped by UMReadCompact()
+} UMGeometry;
+
+// node orderings for UMReorder()
+typedef enum {UM_REORDER_NONE, UM_REORDER_RCM, UM_REORDER_HILBERT} UMReorderType;
+
 // data type for an Unstructured Mesh
 typedef struct {
     int      N,     // number of nodes
@@ -25,6 +39,21 @@ typedef struct {
              bfs;   // flag for boundary segments; length P
                     //     if abfs[p] == 1 then segment p is Neumann
                     //     if abfs[p] == 2 then segment p is Dirichlet
+    // after UMDistribute() the above describe the local mesh on this process
+    int      Nown,  // number of owned nodes; local nodes 0,...,Nown-1
+             Nglobal;// number of nodes in whole mesh
+    ISLocalToGlobalMapping ltog; // local node index to global (solution) index
+    IS       app;   // local node index to node index in mesh file; length N
+    UMGeometry *geom;// NULL unless UMCreateGeometry() is called
+    int      *part, // process owning node n of whole mesh is part[n]; length
+             nparts;//     N, for nparts processes; see UMPartition()
+    void     *map;  // file mapped by UMReadCompact(), or NULL
+    size_t   maplen;
+    int      ncolors,   // elements of color c, which share no nodes, are
+             *colorptr, //     colorelt[colorptr[c]],...,colorelt[colorptr[c+1]-1];
+             *colorelt; //     see UMCreateElementColoring()
+    PetscLogDouble bytesread;// bytes of mesh data read from files by this
+                        //     process; UM operations are also log events
 } UM;
 //ENDSTRUCT
 
@@ -40,10 +69,87 @@ PetscErrorCode UMReadNodes(UM *mesh, char *filename);
 // boundary flags into them; call UMReadNodes() first
 PetscErrorCode UMReadISs(UM *mesh, char *filename);
 
+// alternative to UMReadNodes() and UMReadISs():  read root.node, root.ele,
+// and root.poly as written by triangle; rank 0 of PETSC_COMM_WORLD parses
+// and broadcasts, so each process has the whole mesh as above
+PetscErrorCode UMReadTriangle(UM *mesh, const char *root);
+
+// alternative to UMReadNodes() and UMReadISs():  map a file written by
+// UMWriteCompact() into memory; nodes, elements, segments, and flags are
+// used in place, without copying, as is the cached geometry and the
+// partition table if the file has them
+PetscErrorCode UMReadCompact(UM *mesh, const char *filename);
+
+// write the whole mesh (i.e. before UMDistribute(), from one process) in
+// the compact format read by UMReadCompact(), including the geometry and
+// partition table if present
+PetscErrorCode UMWriteCompact(UM *mesh, const char *filename);
+
+// compute the partition table part[] for the processes of comm, unless one
+// for this number of processes is already present; called by UMDistribute()
+PetscErrorCode UMPartition(UM *mesh, MPI_Comm comm);
+
+// number the E edges of the mesh; ke[3*k+l] is the edge of element k
+// from node l to node (l+1) mod 3, and sedge[p] (if sedge is not NULL) is
+// the edge of boundary segment p; free ke,sedge with PetscFree()
+PetscErrorCode UMCreateEdges(UM *mesh, int *E, int **ke, int **sedge);
+
+// split each element of the whole mesh (i.e. before UMDistribute(), or after
+// it on one process) into four at its edge midpoints; fine keeps the nodes of
+// coarse, with the same indices, followed by the midpoints, which get boundary
+// flags from the segments they split; if interp is not NULL it gets the
+// (SeqAIJ) P1 interpolation from coarse to fine, without entries coupling
+// Dirichlet to other nodes
+PetscErrorCode UMRefineUniform(UM *coarse, UM *fine, Mat *interp);
+
+// refine the whole mesh by longest-edge bisection of the elements k with
+// marked[k] true, and of neighbors as needed for conformity; node numbering
+// and boundary flags are as in UMRefineUniform(), but interp, for transfer of
+// solutions, has all entries
+PetscErrorCode UMRefineMarked(UM *coarse, const PetscBool *marked, UM *fine,
+                              Mat *interp);
+
+// renumber nodes by reverse Cuthill-McKee (to reduce matrix bandwidth) or
+// along a Hilbert curve (for locality), and sort elements by their first
+// node; app keeps the original node index; call before UMDistribute()
+PetscErrorCode UMReorder(UM *mesh, UMReorderType method);
+
+// partition nodes among the processes of comm and replace the mesh by the
+// local mesh: owned nodes (renumbered contiguously), then ghost nodes, and
+// the elements and boundary segments which touch an owned node; call after
+// UMReadISs() and any other operations on the whole mesh
+PetscErrorCode UMDistribute(UM *mesh, MPI_Comm comm);
+
+// neighbors of each local node, not including itself, in compressed sparse
+// row form:  neighbors of n are ja[ia[n]],...,ja[ia[n+1]-1], sorted;
+// free ia,ja with PetscFree()
+PetscErrorCode UMNodeAdjacency(UM *mesh, int **ia, int **ja);
+
+// scatter from a global (solution) Vec with local size Nown to a sequential
+// Vec of length N which includes ghost nodes; call after UMDistribute()
+PetscErrorCode UMCreateGlobalToLocal(UM *mesh, Vec u, Vec *uloc, VecScatter *ctx);
+
+// compute and store element geometry (see UMGeometry) for the mesh, using
+// the symmgauss[] quadrature rule of given degree; call after UMDistribute()
+// (which discards any whole-mesh geometry when there are several processes);
+// does nothing if geometry for this degree is already present
+PetscErrorCode UMCreateGeometry(UM *mesh, int quaddegree);
+
+// color the elements so that no two elements of the same color share a node,
+// so each color can be assembled by threads without conflicts; call after
+// UMDistribute() and any reordering; leaves colorptr NULL if more than 64
+// colors would be needed
+PetscErrorCode UMCreateElementColoring(UM *mesh);
+
 // view all fields in UM to the viewer
 PetscErrorCode UMViewASCII(UM *mesh, PetscViewer viewer);
 PetscErrorCode UMViewSolutionBinary(UM *mesh, char *filename, Vec u);
 
+// write the mesh and nodal values u for ParaView etc.:  root.vtu in serial,
+// or root_<rank>.vtu from each process plus root.pvtu listing them; call
+// after UMDistribute()
+PetscErrorCode UMViewSolutionVTK(UM *mesh, const char *root, Vec u);
+
 // compute statistics for mesh:  maxh,meanh = maximum/mean of side
 // lengths; maxa,meana = maximum/mean of areas
 PetscErrorCode UMStats(UM *mesh, double *maxh, double *meanh,
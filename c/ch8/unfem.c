@@ -6,13 +6,69 @@ static char help[] = "Unstructured 2D FEM solution of nonlinear Poisson equation
 "(There are three different solution cases implemented for these functions.)\n"
 "Input files in PETSc binary format contain node coordinates, elements, and\n"
 "boundary flags.  Allows non-homogeneous Dirichlet and Neumann conditions\n"
-"along subsets of boundary.\n\n";
+"along subsets of boundary.  In parallel, nodes are partitioned using\n"
+"MatPartitioning (e.g. -mat_partitioning_type parmetis).  With -un_color,\n"
+"element loops are threaded by OpenMP if compiled with it.  Option -un_order 2\n"
+"uses P2 elements (serial only).  Option -un_mg_levels refines the mesh\n"
+"uniformly and solves by geometric multigrid (serial only).  Option\n"
+"-un_adapt_steps refines adaptively by a residual error estimator (serial\n"
+"only).  Option -un_perf_summary reports load and assembly rates.\n\n";
 
 #include <petsc.h>
 #include "../quadrature.h"
 #include "um.h"
 #include "cases.h"
 
+typedef enum {PETSCBINARY, TRIANGLE, COMPACT} MeshFormatType;
+static const char* MeshFormatTypes[] = {"petsc","triangle","compact",
+                                        "MeshFormatType", "", NULL};
+
+static const char* UMReorderTypes[] = {"none","rcm","hilbert",
+                                       "UMReorderType", "UM_REORDER_", NULL};
+
+// P2 degrees of freedom; see P2Setup()
+typedef struct {
+    int    N2,        // number of dofs:  N nodes plus E edge midpoints
+           *e2,       // 6 dofs of each element; length 6K
+           *bfn2,     // flag for each dof, as for bfn; length N2
+           *smid;     // dof at midpoint of each boundary segment; length P
+    Node   *loc2;     // location of each dof
+    double *gD2;      // g_D at Dirichlet dofs (otherwise zero)
+} P2Space;
+
+// Neumann segments which contribute to owned residual rows; see NeumannSetup()
+typedef struct {
+    int    n,         // number of segments in the list
+           rule,      // index into gausslegendre[]
+           *node;     // end nodes node[2*i],node[2*i+1] of segment i, or -1
+                      //     for an end which is Dirichlet or not owned
+    double *ls,       // length of segment i
+           *x, *y;    // quadrature point r of segment i is (x[nq*i+r],y[nq*i+r])
+} NeumannList;
+
+// coarse levels for -un_mg_levels; see MGCreateHierarchy()
+typedef struct {
+    int        nlevels;  // number of levels; the solution mesh is the finest
+    UM         *mesh;    // meshes on coarse levels 0,...,nlevels-2
+    Mat        *A,       // rediscretized Picard operators on coarse levels
+               *P;       // P[l] interpolates from level l-1 to level l
+    IS         *inject;  // coarse level l nodes are the first N of finest
+    double     **gDnode; // as in unfemCtx, on each coarse level
+    Vec        *uloc;
+    VecScatter *ltog;
+} MGHierarchy;
+
+// accumulated over all meshes, for -un_perf_summary
+typedef struct {
+    PetscLogDouble readtime,  // seconds reading the mesh
+                   restime,   // seconds in residual evaluations
+                   jactime;   //    and Jacobian evaluations
+    double         reselts,   // local elements processed in these
+                   jacelts;
+    int            rescount, jaccount;
+    PetscErrorCode (*jacfcn)(SNES,Vec,Mat,Mat,void*);  // FormPicard or FormNewton
+} PerfSummary;
+
 //STARTCTX
 typedef struct {
     UM     *mesh;
@@ -20,9 +76,28 @@ typedef struct {
            quaddegree;
     double (*a_fcn)(double, double, double);
     double (*f_fcn)(double, double, double);
+    double (*dadu_fcn)(double, double, double);  // derivatives for Newton
+    double (*dfdu_fcn)(double, double, double);
     double (*gD_fcn)(double, double);
     double (*gN_fcn)(double, double);
     double (*uexact_fcn)(double, double);
+    double *gDnode;   // gD_fcn() at each local Dirichlet node (otherwise zero)
+    Vec    uloc;      // local (owned+ghost) values of u; see UMCreateGlobalToLocal()
+    VecScatter ltog;  // global u to uloc
+    // for -un_matfree only:
+    double *mfa,      // a(u) at quadrature points of each element
+           *mfdadu,   // (da/du)(u), (df/du)(u) at quadrature points (Newton)
+           *mfdfdu,
+           *mfgradu;  // grad u on each element (Newton)
+    PetscBool mfnewton;
+    PetscBool usecsrslots;  // -un_csrslots
+    int    *csrslot;  // offsets of element matrix entries; see CreateCSRSlots()
+    Vec    vloc,      // local values of input to MatMult_MatFree()
+           mfdiag;    // diagonal of linearized operator
+    P2Space *p2;      // NULL unless -un_order 2
+    MGHierarchy *mg;  // NULL unless -un_mg_levels is more than one
+    NeumannList neu;
+    PerfSummary perf;
     PetscLogStage readstage, setupstage, solverstage, resstage, jacstage;  //STRIP
 } unfemCtx;
 //ENDCTX
@@ -32,9 +107,15 @@ PetscErrorCode FillExact(Vec uexact, unfemCtx *ctx) {
     const Node   *aloc;
     double       *auexact;
     int          i;
-    ierr = UMGetNodeCoordArrayRead(ctx->mesh,&aloc); CHKERRQ(ierr);
     ierr = VecGetArray(uexact,&auexact); CHKERRQ(ierr);
-    for (i = 0; i < ctx->mesh->N; i++) {
+    if (ctx->p2) {
+        for (i = 0; i < ctx->p2->N2; i++)
+            auexact[i] = ctx->uexact_fcn(ctx->p2->loc2[i].x,ctx->p2->loc2[i].y);
+        ierr = VecRestoreArray(uexact,&auexact); CHKERRQ(ierr);
+        return 0;
+    }
+    ierr = UMGetNodeCoordArrayRead(ctx->mesh,&aloc); CHKERRQ(ierr);
+    for (i = 0; i < ctx->mesh->Nown; i++) {
         auexact[i] = ctx->uexact_fcn(aloc[i].x,aloc[i].y);
     }
     ierr = VecRestoreArray(uexact,&auexact); CHKERRQ(ierr);
@@ -42,6 +123,86 @@ PetscErrorCode FillExact(Vec uexact, unfemCtx *ctx) {
     return 0;
 }
 
+// evaluate g_D at local (owned and ghost) Dirichlet nodes
+PetscErrorCode FillDirichlet(unfemCtx *ctx) {
+    PetscErrorCode ierr;
+    const Node   *aloc;
+    const int    *abfn;
+    int          i;
+    ierr = PetscCalloc1(ctx->mesh->N,&(ctx->gDnode)); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(ctx->mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(ctx->mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (i = 0; i < ctx->mesh->N; i++) {
+        if (abfn[i] == 2)
+            ctx->gDnode[i] = ctx->gD_fcn(aloc[i].x,aloc[i].y);
+    }
+    ierr = ISRestoreIndices(ctx->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(ctx->mesh,&aloc); CHKERRQ(ierr);
+    return 0;
+}
+
+/* Gauss-Legendre rule for segments:  n points are exact for degree 2n-1, and
+the integrand g_N psi has one more degree than g_N, so -un_quaddegree 1 gives
+the midpoint rule and 4 or 5 give three points.  */
+PetscErrorCode NeumannSetup(unfemCtx *ctx) {
+    PetscErrorCode ierr;
+    const Node   *aloc;
+    const int    *abfn, *as, *abfs;
+    int          p, i, l, r, nq, na, nb, *keep;
+    double       dx, dy, t;
+    NeumannList  *neu = &(ctx->neu);
+    neu->rule = PetscMin(3,ctx->quaddegree/2 + 1) - 1;
+    nq = gausslegendre[neu->rule].n;
+    ierr = UMGetNodeCoordArrayRead(ctx->mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(ctx->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = ISGetIndices(ctx->mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISGetIndices(ctx->mesh->bfs,&abfs); CHKERRQ(ierr);
+    // keep[2*p+l] is end l of segment p if it gets a contribution, else -1
+    ierr = PetscMalloc1(2*ctx->mesh->P,&keep); CHKERRQ(ierr);
+    neu->n = 0;
+    for (p = 0; p < ctx->mesh->P; p++) {
+        for (l = 0; l < 2; l++) {
+            const int m = as[2*p+l];
+            keep[2*p+l] = (abfs[p] == 1 && m < ctx->mesh->Nown && abfn[m] != 2) ? m : -1;
+        }
+        if (keep[2*p] >= 0 || keep[2*p+1] >= 0)
+            neu->n++;
+    }
+    ierr = PetscMalloc4(2*neu->n,&(neu->node),neu->n,&(neu->ls),
+                        nq*neu->n,&(neu->x),nq*neu->n,&(neu->y)); CHKERRQ(ierr);
+    i = 0;
+    for (p = 0; p < ctx->mesh->P; p++) {
+        if (keep[2*p] < 0 && keep[2*p+1] < 0)
+            continue;
+        na = as[2*p+0];
+        nb = as[2*p+1];
+        neu->node[2*i+0] = keep[2*p+0];
+        neu->node[2*i+1] = keep[2*p+1];
+        dx = aloc[nb].x - aloc[na].x;
+        dy = aloc[nb].y - aloc[na].y;
+        neu->ls[i] = sqrt(dx * dx + dy * dy);
+        for (r = 0; r < nq; r++) {
+            t = 0.5 * (1.0 + gausslegendre[neu->rule].xi[r]);
+            neu->x[nq*i+r] = aloc[na].x + t * dx;
+            neu->y[nq*i+r] = aloc[na].y + t * dy;
+        }
+        i++;
+    }
+    ierr = PetscFree(keep); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(ctx->mesh->bfs,&abfs); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(ctx->mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(ctx->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(ctx->mesh,&aloc); CHKERRQ(ierr);
+    return 0;
+}
+
+PetscErrorCode NeumannDestroy(NeumannList *neu) {
+    PetscErrorCode ierr;
+    ierr = PetscFree4(neu->node,neu->ls,neu->x,neu->y); CHKERRQ(ierr);
+    neu->n = 0;
+    return 0;
+}
+
 //STARTFEM
 double chi(int L, double xi, double eta) {
     if (L == 0)
@@ -66,19 +227,144 @@ double InnerProd(const double V[2], const double W[2]) {
 }
 //ENDFEM
 
-//STARTRESIDUAL
-PetscErrorCode FormFunction(SNES snes, Vec u, Vec F, void *ctx) {
+// geometry of element k with nodes en[]:  |det J|, gradients of hat
+// functions, and coordinates of quadrature points; from the cache if
+// UMCreateGeometry() was called, otherwise computed
+void ElementGeometry(const UM *mesh, const Node *aloc, const int *en, int k,
+                     const Quad2DTri *q, double *absdetJ, double gradpsi[3][2],
+                     double xq[], double yq[]) {
+    const UMGeometry *g = mesh->geom;
+    double dx1, dx2, dy1, dy2, detJ;
+    int    l, r;
+    if (g) {
+        *absdetJ = g->absdetJ[k];
+        for (l = 0; l < 3; l++) {
+            gradpsi[l][0] = g->gx[3*k+l];
+            gradpsi[l][1] = g->gy[3*k+l];
+        }
+        for (r = 0; r < q->n; r++) {
+            xq[r] = g->xq[q->n*k+r];
+            yq[r] = g->yq[q->n*k+r];
+        }
+        return;
+    }
+    dx1 = aloc[en[1]].x - aloc[en[0]].x;
+    dx2 = aloc[en[2]].x - aloc[en[0]].x;
+    dy1 = aloc[en[1]].y - aloc[en[0]].y;
+    dy2 = aloc[en[2]].y - aloc[en[0]].y;
+    detJ = dx1 * dy2 - dx2 * dy1;
+    *absdetJ = fabs(detJ);
+    for (l = 0; l < 3; l++) {
+        gradpsi[l][0] = ( dy2 * dchi[l][0] - dy1 * dchi[l][1]) / detJ;
+        gradpsi[l][1] = (-dx2 * dchi[l][0] + dx1 * dchi[l][1]) / detJ;
+    }
+    for (r = 0; r < q->n; r++) {
+        xq[r] = aloc[en[0]].x + dx1 * q->xi[r] + dx2 * q->eta[r];
+        yq[r] = aloc[en[0]].y + dy1 * q->xi[r] + dy2 * q->eta[r];
+    }
+}
+
+// P2 elements (-un_order 2) ------------------------------------------------
+
+// degrees of freedom are the N nodes followed by the E edge midpoints; local
+// dofs 0,1,2 of an element are its nodes and 3+l is the midpoint of the
+// edge from node l to node (l+1) mod 3
+PetscErrorCode P2Setup(unfemCtx *user) {
     PetscErrorCode ierr;
-    unfemCtx        *user = (unfemCtx*)ctx;
+    UM          *mesh = user->mesh;
+    P2Space     *p2;
+    const Node  *aloc;
+    const int   *ae, *abfn, *as, *abfs;
+    int         *ke, *sedge, E, n, k, l, p, i, na, nb;
+    ierr = PetscNew(&p2); CHKERRQ(ierr);
+    ierr = UMCreateEdges(mesh,&E,&ke,&sedge); CHKERRQ(ierr);
+    p2->N2 = mesh->N + E;
+    ierr = PetscMalloc1(6*mesh->K,&(p2->e2)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(mesh->P,&(p2->smid)); CHKERRQ(ierr);
+    ierr = PetscCalloc1(p2->N2,&(p2->bfn2)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(p2->N2,&(p2->loc2)); CHKERRQ(ierr);
+    ierr = PetscCalloc1(p2->N2,&(p2->gD2)); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < mesh->N; n++) {
+        p2->loc2[n] = aloc[n];
+        p2->bfn2[n] = abfn[n];
+    }
+    for (k = 0; k < mesh->K; k++) {
+        for (l = 0; l < 3; l++) {
+            na = ae[3*k+l];
+            nb = ae[3*k+(l+1)%3];
+            i = mesh->N + ke[3*k+l];
+            p2->e2[6*k+l] = na;
+            p2->e2[6*k+3+l] = i;
+            p2->loc2[i].x = 0.5 * (aloc[na].x + aloc[nb].x);
+            p2->loc2[i].y = 0.5 * (aloc[na].y + aloc[nb].y);
+        }
+    }
+    // midpoints of boundary segments get the flag of the segment
+    ierr = ISGetIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISGetIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    for (p = 0; p < mesh->P; p++) {
+        p2->smid[p] = mesh->N + sedge[p];
+        p2->bfn2[p2->smid[p]] = (abfs[p] == 2) ? 2 : 1;
+    }
+    ierr = ISRestoreIndices(mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->bfs,&abfs); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(mesh,&aloc); CHKERRQ(ierr);
+    for (i = 0; i < p2->N2; i++) {
+        if (p2->bfn2[i] == 2)
+            p2->gD2[i] = user->gD_fcn(p2->loc2[i].x,p2->loc2[i].y);
+    }
+    ierr = PetscFree(ke); CHKERRQ(ierr);
+    ierr = PetscFree(sedge); CHKERRQ(ierr);
+    user->p2 = p2;
+    return 0;
+}
+
+PetscErrorCode P2Destroy(P2Space **p2) {
+    if (!(*p2))
+        return 0;
+    PetscFree((*p2)->e2);
+    PetscFree((*p2)->smid);
+    PetscFree((*p2)->bfn2);
+    PetscFree((*p2)->loc2);
+    PetscFree((*p2)->gD2);
+    PetscFree(*p2);
+    return 0;
+}
+
+// P2 basis functions phi[] and their gradients at (xi,eta), from the
+// barycentric coordinates L_l and the gradients of the P1 hat functions
+void P2Basis(double gradpsi[3][2], double xi, double eta,
+             double phi[6], double gradphi[6][2]) {
+    const double L[3] = {1.0 - xi - eta, xi, eta};
+    int l, lp, d;
+    for (l = 0; l < 3; l++) {
+        lp = (l+1) % 3;
+        phi[l] = L[l] * (2.0 * L[l] - 1.0);
+        phi[3+l] = 4.0 * L[l] * L[lp];
+        for (d = 0; d < 2; d++) {
+            gradphi[l][d] = (4.0 * L[l] - 1.0) * gradpsi[l][d];
+            gradphi[3+l][d] = 4.0 * (L[lp] * gradpsi[l][d] + L[l] * gradpsi[lp][d]);
+        }
+    }
+}
+
+PetscErrorCode FormFunctionP2(SNES snes, Vec u, Vec F, unfemCtx *user) {
+    PetscErrorCode ierr;
+    const P2Space   *p2 = user->p2;
     const Quad2DTri q = symmgauss[user->quaddegree-1];
-    const int       *abfn, *ae, *as, *abfs, *en;
+    const Quad1D    q1 = gausslegendre[2];
+    const int       *ae, *as, *abfs, *en, *bfn2 = p2->bfn2;
     const Node      *aloc;
     const double    *au;
-    double          *aF, unode[3], gradu[2], gradpsi[3][2],
-                    uquad[4], aquad[4], fquad[4],
-                    dx, dy, dx1, dx2, dy1, dy2, detJ,
-                    ls, xmid, ymid, sint, xx, yy, psi, ip, sum;
-    int             n, p, na, nb, k, l, r;
+    double          *aF, unode[6], gradpsi[3][2], phi[6], gradphi[6][2],
+                    xq[MAXPTS_TRI], yq[MAXPTS_TRI], gradu[2], uquad, aquad, fquad,
+                    absdetJ, dx, dy, ls, t, g, psi[3];
+    int             i, k, l, r, p, dof[3];
 
     PetscLogStagePush(user->resstage);  //STRIP
     ierr = VecGetArrayRead(u,&au); CHKERRQ(ierr);
@@ -86,32 +372,35 @@ PetscErrorCode FormFunction(SNES snes, Vec u, Vec F, void *ctx) {
     ierr = VecGetArray(F,&aF); CHKERRQ(ierr);
     ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
 
-    // Dirichlet node residuals
-    ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
-    for (n = 0; n < user->mesh->N; n++) {
-        if (abfn[n] == 2)  // node is Dirichlet
-            aF[n] = au[n] - user->gD_fcn(aloc[n].x,aloc[n].y);
+    // Dirichlet dof residuals
+    for (i = 0; i < p2->N2; i++) {
+        if (bfn2[i] == 2)
+            aF[i] = au[i] - p2->gD2[i];
     }
 
-    // Neumann segment contributions
+    // Neumann segment contributions; 3-point Gauss rule against the 1D P2
+    // basis on the segment
     ierr = ISGetIndices(user->mesh->s,&as); CHKERRQ(ierr);
     ierr = ISGetIndices(user->mesh->bfs,&abfs); CHKERRQ(ierr);
     for (p = 0; p < user->mesh->P; p++) {
-        if (abfs[p] == 1) {  // segment is Neumann
-            na = as[2*p+0];  // nodes at end of segment
-            nb = as[2*p+1];
-            dx = aloc[na].x-aloc[nb].x;
-            dy = aloc[na].y-aloc[nb].y;
-            ls = sqrt(dx * dx + dy * dy);  // length of segment
-            // midpoint rule; psi_na=psi_nb=0.5 at midpoint of segment
-            xmid = 0.5*(aloc[na].x+aloc[nb].x);
-            ymid = 0.5*(aloc[na].y+aloc[nb].y);
-            sint = 0.5 * ls * user->gN_fcn(xmid,ymid);
-            // nodes at end of segment could be Dirichlet
-            if (abfn[na] != 2)
-                aF[na] -= sint;
-            if (abfn[nb] != 2)
-                aF[nb] -= sint;
+        if (abfs[p] != 1)
+            continue;
+        dof[0] = as[2*p+0];
+        dof[1] = p2->smid[p];
+        dof[2] = as[2*p+1];
+        dx = aloc[dof[2]].x - aloc[dof[0]].x;
+        dy = aloc[dof[2]].y - aloc[dof[0]].y;
+        ls = sqrt(dx * dx + dy * dy);
+        for (r = 0; r < q1.n; r++) {
+            t = 0.5 * (q1.xi[r] + 1.0);
+            psi[0] = (1.0 - t) * (1.0 - 2.0 * t);
+            psi[1] = 4.0 * t * (1.0 - t);
+            psi[2] = t * (2.0 * t - 1.0);
+            g = 0.5 * q1.w[r] * ls * user->gN_fcn(aloc[dof[0]].x + t * dx,
+                                                  aloc[dof[0]].y + t * dy);
+            for (l = 0; l < 3; l++)
+                if (bfn2[dof[l]] != 2)
+                    aF[dof[l]] -= g * psi[l];
         }
     }
     ierr = ISRestoreIndices(user->mesh->s,&as); CHKERRQ(ierr);
@@ -120,135 +409,577 @@ PetscErrorCode FormFunction(SNES snes, Vec u, Vec F, void *ctx) {
     // element contributions
     ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
     for (k = 0; k < user->mesh->K; k++) {
-        en = ae + 3*k;  // en[0], en[1], en[2] are nodes of element k
-        // geometry of element
-        dx1 = aloc[en[1]].x - aloc[en[0]].x;
-        dx2 = aloc[en[2]].x - aloc[en[0]].x;
-        dy1 = aloc[en[1]].y - aloc[en[0]].y;
-        dy2 = aloc[en[2]].y - aloc[en[0]].y;
-        detJ = dx1 * dy2 - dx2 * dy1;
-        // gradients of hat functions
-        for (l = 0; l < 3; l++) {
-            gradpsi[l][0] = ( dy2 * dchi[l][0] - dy1 * dchi[l][1]) / detJ;
-            gradpsi[l][1] = (-dx2 * dchi[l][0] + dx1 * dchi[l][1]) / detJ;
+        en = p2->e2 + 6*k;
+        ElementGeometry(user->mesh,aloc,ae+3*k,k,&q,&absdetJ,gradpsi,xq,yq);
+        for (l = 0; l < 6; l++)
+            unode[l] = (bfn2[en[l]] == 2) ? p2->gD2[en[l]] : au[en[l]];
+        for (r = 0; r < q.n; r++) {
+            P2Basis(gradpsi,q.xi[r],q.eta[r],phi,gradphi);
+            uquad = 0.0;
+            gradu[0] = 0.0;
+            gradu[1] = 0.0;
+            for (l = 0; l < 6; l++) {
+                uquad += unode[l] * phi[l];
+                gradu[0] += unode[l] * gradphi[l][0];
+                gradu[1] += unode[l] * gradphi[l][1];
+            }
+            aquad = user->a_fcn(uquad,xq[r],yq[r]);
+            fquad = user->f_fcn(uquad,xq[r],yq[r]);
+            for (l = 0; l < 6; l++) {
+                if (bfn2[en[l]] != 2)
+                    aF[en[l]] += absdetJ * q.w[r]
+                                 * ( aquad * InnerProd(gradu,gradphi[l])
+                                     - fquad * phi[l] );
+            }
+        }
+    }
+    ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(u,&au); CHKERRQ(ierr);
+    ierr = VecRestoreArray(F,&aF); CHKERRQ(ierr);
+    PetscLogStagePop();  //STRIP
+    return 0;
+}
+
+// P2 version of FormPicardOrNewton(); same formulas for the entries
+PetscErrorCode FormPicardOrNewtonP2(Vec u, Mat A, Mat P, unfemCtx *user,
+                                    PetscBool newton) {
+    PetscErrorCode ierr;
+    const P2Space   *p2 = user->p2;
+    const Quad2DTri q = symmgauss[user->quaddegree-1];
+    const int       *ae, *en, *bfn2 = p2->bfn2;
+    const Node      *aloc;
+    const double    *au;
+    double          unode[6], gradpsi[3][2], phi[6], gradphi[6][2],
+                    xq[MAXPTS_TRI], yq[MAXPTS_TRI], gradu[2], uquad, aquad,
+                    daquad = 0.0, dfquad = 0.0, absdetJ, Ke[6][6], v[36], one = 1.0;
+    int             i, k, l, m, r, cr, cc, row[6], col[6];
+
+    PetscLogStagePush(user->jacstage);  //STRIP
+    ierr = MatZeroEntries(P); CHKERRQ(ierr);
+    for (i = 0; i < p2->N2; i++) {
+        if (bfn2[i] == 2) {
+            ierr = MatSetValues(P,1,&i,1,&i,&one,ADD_VALUES); CHKERRQ(ierr);
+        }
+    }
+    ierr = VecGetArrayRead(u,&au); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < user->mesh->K; k++) {
+        en = p2->e2 + 6*k;
+        ElementGeometry(user->mesh,aloc,ae+3*k,k,&q,&absdetJ,gradpsi,xq,yq);
+        for (l = 0; l < 6; l++)
+            unode[l] = (bfn2[en[l]] == 2) ? p2->gD2[en[l]] : au[en[l]];
+        for (l = 0; l < 6; l++)
+            for (m = 0; m < 6; m++)
+                Ke[l][m] = 0.0;
+        for (r = 0; r < q.n; r++) {
+            P2Basis(gradpsi,q.xi[r],q.eta[r],phi,gradphi);
+            uquad = 0.0;
+            gradu[0] = 0.0;
+            gradu[1] = 0.0;
+            for (l = 0; l < 6; l++) {
+                uquad += unode[l] * phi[l];
+                gradu[0] += unode[l] * gradphi[l][0];
+                gradu[1] += unode[l] * gradphi[l][1];
+            }
+            aquad = user->a_fcn(uquad,xq[r],yq[r]);
+            if (newton) {
+                daquad = user->dadu_fcn(uquad,xq[r],yq[r]);
+                dfquad = user->dfdu_fcn(uquad,xq[r],yq[r]);
+            }
+            for (l = 0; l < 6; l++) {
+                for (m = 0; m < 6; m++) {
+                    Ke[l][m] += absdetJ * q.w[r] * aquad
+                                * InnerProd(gradphi[l],gradphi[m]);
+                    if (newton)
+                        Ke[l][m] += absdetJ * q.w[r] * phi[m]
+                                    * ( daquad * InnerProd(gradu,gradphi[l])
+                                        - dfquad * phi[l] );
+                }
+            }
+        }
+        // rows and columns are non-Dirichlet dofs
+        cc = 0;
+        for (m = 0; m < 6; m++)
+            if (bfn2[en[m]] != 2)
+                col[cc++] = en[m];
+        cr = 0;
+        for (l = 0; l < 6; l++) {
+            if (bfn2[en[l]] != 2) {
+                row[cr] = en[l];
+                for (m = 0, i = 0; m < 6; m++)
+                    if (bfn2[en[m]] != 2)
+                        v[cr*cc + i++] = Ke[l][m];
+                cr++;
+            }
+        }
+        ierr = MatSetValues(P,cr,row,cc,col,v,ADD_VALUES); CHKERRQ(ierr);
+    }
+    ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(u,&au); CHKERRQ(ierr);
+
+    ierr = MatAssemblyBegin(P,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    ierr = MatAssemblyEnd(P,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    if (A != P) {
+        ierr = MatAssemblyBegin(A,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+        ierr = MatAssemblyEnd(A,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    }
+    ierr = MatSetOption(P,MAT_NEW_NONZERO_LOCATION_ERR,PETSC_TRUE); CHKERRQ(ierr);
+    PetscLogStagePop();  //STRIP
+    return 0;
+}
+
+// nonzeros per row:  dofs sharing an element (one for Dirichlet rows)
+PetscErrorCode PreallocationP2(Mat J, unfemCtx *user) {
+    PetscErrorCode ierr;
+    const P2Space *p2 = user->p2;
+    int           *ia, *ja, *cnt, *nnz, i, k, l, m, len;
+    ierr = PetscCalloc1(p2->N2+1,&ia); CHKERRQ(ierr);
+    for (k = 0; k < user->mesh->K; k++)
+        for (l = 0; l < 6; l++)
+            ia[p2->e2[6*k+l]+1] += 6;
+    for (i = 0; i < p2->N2; i++)
+        ia[i+1] += ia[i];
+    ierr = PetscMalloc1(ia[p2->N2],&ja); CHKERRQ(ierr);
+    ierr = PetscCalloc1(p2->N2,&cnt); CHKERRQ(ierr);
+    for (k = 0; k < user->mesh->K; k++)
+        for (l = 0; l < 6; l++)
+            for (m = 0; m < 6; m++) {
+                i = p2->e2[6*k+l];
+                ja[ia[i] + cnt[i]++] = p2->e2[6*k+m];
+            }
+    ierr = PetscMalloc1(p2->N2,&nnz); CHKERRQ(ierr);
+    for (i = 0; i < p2->N2; i++) {
+        len = ia[i+1] - ia[i];
+        ierr = PetscSortRemoveDupsInt(&len,ja+ia[i]); CHKERRQ(ierr);
+        nnz[i] = (p2->bfn2[i] == 2) ? 1 : len;
+    }
+    ierr = MatSeqAIJSetPreallocation(J,-1,nnz); CHKERRQ(ierr);
+    ierr = PetscFree(ia); CHKERRQ(ierr);
+    ierr = PetscFree(ja); CHKERRQ(ierr);
+    ierr = PetscFree(cnt); CHKERRQ(ierr);
+    ierr = PetscFree(nnz); CHKERRQ(ierr);
+    return 0;
+}
+
+//STARTRESIDUAL
+// add residual contributions of element k to owned, non-Dirichlet rows
+static void ResidualElement(const unfemCtx *user, const Quad2DTri *q,
+                            const Node *aloc, const int *ae, const int *abfn,
+                            const double *au, int k, double *aF) {
+    const int *en = ae + 3*k;  // en[0], en[1], en[2] are nodes of element k
+    double    unode[3], gradu[2], gradpsi[3][2],
+              uquad[MAXPTS_TRI], aquad[MAXPTS_TRI], fquad[MAXPTS_TRI],
+              xq[MAXPTS_TRI], yq[MAXPTS_TRI],
+              absdetJ, psi, ip, sum;
+    int       l, r;
+    // geometry of element, gradients of hat functions, quadrature points
+    ElementGeometry(user->mesh,aloc,en,k,q,&absdetJ,gradpsi,xq,yq);
+    // u and grad u on element
+    gradu[0] = 0.0;
+    gradu[1] = 0.0;
+    for (l = 0; l < 3; l++) {
+        if (abfn[en[l]] == 2)
+            unode[l] = user->gDnode[en[l]];
+        else
+            unode[l] = au[en[l]];
+        gradu[0] += unode[l] * gradpsi[l][0];
+        gradu[1] += unode[l] * gradpsi[l][1];
+    }
+    // function values at quadrature points on element
+    for (r = 0; r < q->n; r++) {
+        uquad[r] = eval(unode,q->xi[r],q->eta[r]);
+        aquad[r] = user->a_fcn(uquad[r],xq[r],yq[r]);
+        fquad[r] = user->f_fcn(uquad[r],xq[r],yq[r]);
+    }
+    // residual contribution for each node of element
+    for (l = 0; l < 3; l++) {
+        if (en[l] < user->mesh->Nown && abfn[en[l]] < 2) { // if owned and NOT Dirichlet
+            sum = 0.0;
+            for (r = 0; r < q->n; r++) {
+                psi = chi(l,q->xi[r],q->eta[r]);
+                ip  = InnerProd(gradu,gradpsi[l]);
+                sum += q->w[r] * ( aquad[r] * ip - fquad[r] * psi );
+            }
+            aF[en[l]] += absdetJ * sum;
         }
-        // u and grad u on element
+    }
+}
+
+PetscErrorCode FormFunction(SNES snes, Vec u, Vec F, void *ctx) {
+    PetscErrorCode ierr;
+    unfemCtx        *user = (unfemCtx*)ctx;
+    const Quad2DTri q = symmgauss[user->quaddegree-1];
+    const Quad1D    q1 = gausslegendre[user->neu.rule];
+    const int       *abfn, *ae, *nn;
+    const Node      *aloc;
+    const double    *au;
+    double          *aF, g, sa, sb, t;
+    int             n, i, r, k, c, j;
+
+    if (user->p2)
+        return FormFunctionP2(snes,u,F,user);
+    PetscLogStagePush(user->resstage);  //STRIP
+    // residual rows are owned nodes n < Nown; elements may reference ghosts
+    ierr = VecScatterBegin(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecGetArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = VecSet(F,0.0); CHKERRQ(ierr);
+    ierr = VecGetArray(F,&aF); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+
+    // Dirichlet node residuals
+    ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < user->mesh->Nown; n++) {
+        if (abfn[n] == 2)  // node is Dirichlet
+            aF[n] = au[n] - user->gDnode[n];
+    }
+
+    // Neumann segment contributions:  psi_na = 1-t and psi_nb = t at the
+    // point of the segment with parameter t in [0,1]
+    for (i = 0; i < user->neu.n; i++) {
+        nn = user->neu.node + 2*i;
+        sa = 0.0;
+        sb = 0.0;
+        for (r = 0; r < q1.n; r++) {
+            t = 0.5 * (1.0 + q1.xi[r]);
+            g = q1.w[r] * user->gN_fcn(user->neu.x[q1.n*i+r],user->neu.y[q1.n*i+r]);
+            sa += g * (1.0 - t);
+            sb += g * t;
+        }
+        if (nn[0] >= 0)
+            aF[nn[0]] -= 0.5 * user->neu.ls[i] * sa;
+        if (nn[1] >= 0)
+            aF[nn[1]] -= 0.5 * user->neu.ls[i] * sb;
+    }
+
+    // element contributions; elements of one color share no nodes, so
+    // threads may add into aF[] without conflicts
+    ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    if (user->mesh->colorptr) {
+        for (c = 0; c < user->mesh->ncolors; c++) {
+#pragma omp parallel for schedule(static)
+            for (j = user->mesh->colorptr[c]; j < user->mesh->colorptr[c+1]; j++)
+                ResidualElement(user,&q,aloc,ae,abfn,au,user->mesh->colorelt[j],aF);
+        }
+    } else {
+        for (k = 0; k < user->mesh->K; k++)
+            ResidualElement(user,&q,aloc,ae,abfn,au,k,aF);
+    }
+
+    ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = VecRestoreArray(F,&aF); CHKERRQ(ierr);
+    PetscLogStagePop();  //STRIP
+    return 0;
+}
+//ENDRESIDUAL
+
+typedef enum {PICARD, NEWTON} JacobianType;
+static const char* JacobianTypes[] = {"picard","newton",
+                                      "JacobianType", "", NULL};
+
+/* Coefficients at the quadrature points of one element:  a(u), and if
+newton is true also (da/du)(u), (df/du)(u), and the (constant) grad u. */
+static void ElementCoefficients(const unfemCtx *user, const Quad2DTri *q,
+                                const double unode[3], double gradpsi[3][2],
+                                const double xq[], const double yq[],
+                                PetscBool newton, double aquad[],
+                                double daquad[], double dfquad[],
+                                double gradu[2]) {
+    double uquad;
+    int    l, r;
+    for (r = 0; r < q->n; r++) {
+        uquad = eval(unode,q->xi[r],q->eta[r]);
+        aquad[r] = user->a_fcn(uquad,xq[r],yq[r]);
+        if (newton) {
+            daquad[r] = user->dadu_fcn(uquad,xq[r],yq[r]);
+            dfquad[r] = user->dfdu_fcn(uquad,xq[r],yq[r]);
+        }
+    }
+    if (newton) {
         gradu[0] = 0.0;
         gradu[1] = 0.0;
         for (l = 0; l < 3; l++) {
-            if (abfn[en[l]] == 2)
-                unode[l] = user->gD_fcn(aloc[en[l]].x,aloc[en[l]].y);
-            else
-                unode[l] = au[en[l]];
             gradu[0] += unode[l] * gradpsi[l][0];
             gradu[1] += unode[l] * gradpsi[l][1];
         }
-        // function values at quadrature points on element
-        for (r = 0; r < q.n; r++) {
-            uquad[r] = eval(unode,q.xi[r],q.eta[r]);
-            xx = aloc[en[0]].x + dx1 * q.xi[r] + dx2 * q.eta[r];
-            yy = aloc[en[0]].y + dy1 * q.xi[r] + dy2 * q.eta[r];
-            aquad[r] = user->a_fcn(uquad[r],xx,yy);
-            fquad[r] = user->f_fcn(uquad[r],xx,yy);
+    }
+}
+
+/* Element stiffness matrix Ke[l][m] for the Picard operator, with entries
+    int_E a(u) grad psi_m . grad psi_l,
+or, if newton is true, for the Jacobian of the residual in FormFunction(),
+which adds the entries
+    int_E (da/du)(u) psi_m (grad u . grad psi_l) - (df/du)(u) psi_m psi_l.
+The Newton Jacobian is not symmetric in general. */
+static void ElementMatrix(const Quad2DTri *q, double absdetJ,
+                          double gradpsi[3][2], const double aquad[],
+                          PetscBool newton, const double daquad[],
+                          const double dfquad[], const double gradu[2],
+                          double Ke[3][3]) {
+    double sum, chil, chim;
+    int    l, m, r;
+    for (l = 0; l < 3; l++) {
+        for (m = 0; m < 3; m++) {
+            sum = 0.0;
+            for (r = 0; r < q->n; r++) {
+                sum += q->w[r] * aquad[r] * InnerProd(gradpsi[l],gradpsi[m]);
+                if (newton) {
+                    chil = chi(l,q->xi[r],q->eta[r]);
+                    chim = chi(m,q->xi[r],q->eta[r]);
+                    sum += q->w[r] * chim
+                             * ( daquad[r] * InnerProd(gradu,gradpsi[l])
+                                 - dfquad[r] * chil );
+                }
+            }
+            Ke[l][m] = absdetJ * sum;
+        }
+    }
+}
+
+// u on element, using g_D at Dirichlet nodes
+static void ElementU(const unfemCtx *user, const int *abfn, const double *au,
+                     const int *en, double unode[3]) {
+    int l;
+    for (l = 0; l < 3; l++) {
+        if (abfn[en[l]] == 2)
+            unode[l] = user->gDnode[en[l]];
+        else
+            unode[l] = au[en[l]];
+    }
+}
+
+// position of entry (row,col) in CSR arrays with sorted columns, or -1
+static int CSRFind(const int *ia, const int *ja, int row, int col) {
+    int lo = ia[row], hi = ia[row+1] - 1, mid;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (ja[mid] == col)
+            return mid;
+        else if (ja[mid] < col)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+// add the element matrix of element k directly into the values aa[] of a
+// SeqAIJ matrix with structure ia,ja; offsets are slot[3*l+m] if slot is
+// not NULL, otherwise found by search; returns the number of entries which
+// are not in the nonzero pattern
+static int ElementIntoCSR(const unfemCtx *user, const Quad2DTri *q,
+                          const Node *aloc, const int *ae, const int *abfn,
+                          const double *au, int k, PetscBool newton,
+                          const int *ia, const int *ja, const int *slot,
+                          double *aa) {
+    const int *en = ae + 3*k;
+    double    unode[3], gradpsi[3][2], gradu[2],
+              aquad[MAXPTS_TRI], daquad[MAXPTS_TRI], dfquad[MAXPTS_TRI],
+              xq[MAXPTS_TRI], yq[MAXPTS_TRI], Ke[3][3], absdetJ;
+    int       l, m, pos, missing = 0;
+    ElementGeometry(user->mesh,aloc,en,k,q,&absdetJ,gradpsi,xq,yq);
+    ElementU(user,abfn,au,en,unode);
+    ElementCoefficients(user,q,unode,gradpsi,xq,yq,newton,
+                        aquad,daquad,dfquad,gradu);
+    ElementMatrix(q,absdetJ,gradpsi,aquad,newton,daquad,dfquad,gradu,Ke);
+    for (l = 0; l < 3; l++) {
+        if (abfn[en[l]] == 2)
+            continue;
+        for (m = 0; m < 3; m++) {
+            if (abfn[en[m]] == 2)
+                continue;
+            pos = (slot) ? slot[3*l+m] : CSRFind(ia,ja,en[l],en[m]);
+            if (pos < 0)
+                missing++;
+            else
+                aa[pos] += Ke[l][m];
         }
-        // residual contribution for each node of element
+    }
+    return missing;
+}
+
+// symbolic pass:  record offsets into the CSR value array of the 9 entries of
+// each element matrix; -1 for entries in Dirichlet rows or columns
+static PetscErrorCode CreateCSRSlots(unfemCtx *user, const int *abfn,
+                                     const int *ia, const int *ja) {
+    PetscErrorCode ierr;
+    const int *ae, *en;
+    int       k, l, m, *slot;
+    ierr = PetscMalloc1(9*user->mesh->K,&(user->csrslot)); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    for (k = 0; k < user->mesh->K; k++) {
+        en = ae + 3*k;
+        slot = user->csrslot + 9*k;
         for (l = 0; l < 3; l++) {
-            if (abfn[en[l]] < 2) { // if NOT a Dirichlet node
-                sum = 0.0;
-                for (r = 0; r < q.n; r++) {
-                    psi = chi(l,q.xi[r],q.eta[r]);
-                    ip  = InnerProd(gradu,gradpsi[l]);
-                    sum += q.w[r] * ( aquad[r] * ip - fquad[r] * psi );
+            for (m = 0; m < 3; m++) {
+                if (abfn[en[l]] == 2 || abfn[en[m]] == 2)
+                    slot[3*l+m] = -1;
+                else {
+                    slot[3*l+m] = CSRFind(ia,ja,en[l],en[m]);
+                    if (slot[3*l+m] < 0) {
+                        SETERRQ1(PETSC_COMM_SELF,1,
+                                 "element %d entry not in nonzero pattern",k);
+                    }
                 }
-                aF[en[l]] += fabs(detJ) * sum;
             }
         }
     }
+    ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    return 0;
+}
 
+/* Version of FormPicardOrNewton() for a SeqAIJ matrix which has already been
+assembled once, so its nonzero pattern is fixed.  Entries are added directly
+into the CSR value array, at offsets precomputed by CreateCSRSlots() if
+-un_csrslots is set.  If elements are colored then each color is split among
+threads.  */
+static PetscErrorCode FormPicardOrNewtonCSR(Vec u, Mat A, Mat P,
+                                            unfemCtx *user, PetscBool newton) {
+    PetscErrorCode ierr;
+    const Quad2DTri q = symmgauss[user->quaddegree-1];
+    const int       *abfn, *ae, *ia, *ja;
+    const Node      *aloc;
+    const double    *au;
+    double          *aa;
+    int             n, nrows, c, j, k, pos, missing = 0;
+    PetscBool       done;
+
+    PetscLogStagePush(user->jacstage);  //STRIP
+    ierr = MatGetRowIJ(P,0,PETSC_FALSE,PETSC_FALSE,&nrows,&ia,&ja,&done); CHKERRQ(ierr);
+    if (!done) {
+        SETERRQ(PETSC_COMM_SELF,1,"could not get CSR structure of matrix");
+    }
+    ierr = MatSeqAIJGetArray(P,&aa); CHKERRQ(ierr);
+    ierr = PetscMemzero(aa,ia[nrows]*sizeof(double)); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    if (user->usecsrslots && !user->csrslot) {
+        ierr = CreateCSRSlots(user,abfn,ia,ja); CHKERRQ(ierr);
+    }
+    for (n = 0; n < user->mesh->Nown; n++) {
+        if (abfn[n] == 2) {
+            pos = CSRFind(ia,ja,n,n);
+            if (pos < 0)
+                missing++;
+            else
+                aa[pos] = 1.0;
+        }
+    }
+    ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = VecScatterBegin(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecGetArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    if (user->mesh->colorptr) {
+        for (c = 0; c < user->mesh->ncolors; c++) {
+#pragma omp parallel for schedule(static) private(k) reduction(+:missing)
+            for (j = user->mesh->colorptr[c]; j < user->mesh->colorptr[c+1]; j++) {
+                k = user->mesh->colorelt[j];
+                missing += ElementIntoCSR(user,&q,aloc,ae,abfn,au,k,newton,ia,ja,
+                               (user->csrslot) ? user->csrslot + 9*k : NULL,aa);
+            }
+        }
+    } else {
+        for (k = 0; k < user->mesh->K; k++)
+            missing += ElementIntoCSR(user,&q,aloc,ae,abfn,au,k,newton,ia,ja,
+                           (user->csrslot) ? user->csrslot + 9*k : NULL,aa);
+    }
     ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
     ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(user->uloc,&au); CHKERRQ(ierr);
     ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
-    ierr = VecRestoreArrayRead(u,&au); CHKERRQ(ierr);
-    ierr = VecRestoreArray(F,&aF); CHKERRQ(ierr);
+    ierr = MatSeqAIJRestoreArray(P,&aa); CHKERRQ(ierr);
+    ierr = MatRestoreRowIJ(P,0,PETSC_FALSE,PETSC_FALSE,&nrows,&ia,&ja,&done); CHKERRQ(ierr);
+    if (missing > 0) {
+        SETERRQ1(PETSC_COMM_SELF,2,"%d entries not in nonzero pattern of matrix",missing);
+    }
+
+    ierr = MatAssemblyBegin(P,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    ierr = MatAssemblyEnd(P,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    if (A != P) {
+        ierr = MatAssemblyBegin(A,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+        ierr = MatAssemblyEnd(A,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    }
     PetscLogStagePop();  //STRIP
     return 0;
 }
-//ENDRESIDUAL
 
-PetscErrorCode FormPicard(SNES snes, Vec u, Mat A, Mat P, void *ctx) {
+static PetscErrorCode FormPicardOrNewton(Vec u, Mat A, Mat P, unfemCtx *user,
+                                         PetscBool newton) {
     PetscErrorCode ierr;
-    unfemCtx        *user = (unfemCtx*)ctx;
     const Quad2DTri q = symmgauss[user->quaddegree-1];
     const int       *abfn, *ae, *en;
     const Node      *aloc;
     const double    *au;
-    double          unode[3], gradpsi[3][2],
-                    uquad[4], aquad[4], v[9],
-                    dx1, dx2, dy1, dy2, detJ, xx, yy, sum;
-    int             n, k, l, m, r, cr, cv, row[3];
+    double          unode[3], gradpsi[3][2], gradu[2],
+                    aquad[MAXPTS_TRI], daquad[MAXPTS_TRI], dfquad[MAXPTS_TRI],
+                    xq[MAXPTS_TRI], yq[MAXPTS_TRI], Ke[3][3], v[9], absdetJ;
+    int             n, k, l, m, cr, cc, cv, row[3], col[3];
+    PetscBool       seqaij, assembled;
 
+    if (user->mesh->colorptr || user->usecsrslots) {
+        ierr = PetscObjectTypeCompare((PetscObject)P,MATSEQAIJ,&seqaij); CHKERRQ(ierr);
+        ierr = MatAssembled(P,&assembled); CHKERRQ(ierr);
+        if (seqaij && assembled)
+            return FormPicardOrNewtonCSR(u,A,P,user,newton);
+    }
     PetscLogStagePush(user->jacstage);  //STRIP
     ierr = MatZeroEntries(P); CHKERRQ(ierr);
     ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
-    for (n = 0; n < user->mesh->N; n++) {
+    for (n = 0; n < user->mesh->Nown; n++) {
         if (abfn[n] == 2) {
             v[0] = 1.0;
-            ierr = MatSetValues(P,1,&n,1,&n,v,ADD_VALUES); CHKERRQ(ierr);
+            ierr = MatSetValuesLocal(P,1,&n,1,&n,v,ADD_VALUES); CHKERRQ(ierr);
         }
     }
     ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
-    ierr = VecGetArrayRead(u,&au); CHKERRQ(ierr);
+    ierr = VecScatterBegin(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecGetArrayRead(user->uloc,&au); CHKERRQ(ierr);
     ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
     for (k = 0; k < user->mesh->K; k++) {
         en = ae + 3*k;  // en[0], en[1], en[2] are nodes of element k
-        // geometry of element
-        dx1 = aloc[en[1]].x - aloc[en[0]].x;
-        dx2 = aloc[en[2]].x - aloc[en[0]].x;
-        dy1 = aloc[en[1]].y - aloc[en[0]].y;
-        dy2 = aloc[en[2]].y - aloc[en[0]].y;
-        detJ = dx1 * dy2 - dx2 * dy1;
-        // gradients of hat functions and u on element
-        for (l = 0; l < 3; l++) {
-            gradpsi[l][0] = ( dy2 * dchi[l][0] - dy1 * dchi[l][1]) / detJ;
-            gradpsi[l][1] = (-dx2 * dchi[l][0] + dx1 * dchi[l][1]) / detJ;
-            if (abfn[en[l]] == 2)
-                unode[l] = user->gD_fcn(aloc[en[l]].x,aloc[en[l]].y);
-            else
-                unode[l] = au[en[l]];
-        }
-        // function values at quadrature points on element
-        for (r = 0; r < q.n; r++) {
-            uquad[r] = eval(unode,q.xi[r],q.eta[r]);
-            xx = aloc[en[0]].x + dx1 * q.xi[r] + dx2 * q.eta[r];
-            yy = aloc[en[0]].y + dy1 * q.xi[r] + dy2 * q.eta[r];
-            aquad[r] = user->a_fcn(uquad[r],xx,yy);
+        // geometry of element, gradients of hat functions, quadrature points
+        ElementGeometry(user->mesh,aloc,en,k,&q,&absdetJ,gradpsi,xq,yq);
+        // u on element, and function values at quadrature points
+        ElementU(user,abfn,au,en,unode);
+        ElementCoefficients(user,&q,unode,gradpsi,xq,yq,newton,
+                            aquad,daquad,dfquad,gradu);
+        ElementMatrix(&q,absdetJ,gradpsi,aquad,newton,daquad,dfquad,gradu,Ke);
+        // extract element stiffness matrix; rows are owned non-Dirichlet
+        // nodes, columns are all non-Dirichlet nodes
+        cc = 0; // count columns
+        for (m = 0; m < 3; m++) {
+            if (abfn[en[m]] != 2) {
+                col[cc] = en[m];
+                cc++;
+            }
         }
-        // generate 3x3 element stiffness matrix
         cr = 0; // count rows
         cv = 0; // count values
         for (l = 0; l < 3; l++) {
-            if (abfn[en[l]] != 2) {
+            if (en[l] < user->mesh->Nown && abfn[en[l]] != 2) {
                 row[cr] = en[l];
                 cr++;
                 for (m = 0; m < 3; m++) {
                     if (abfn[en[m]] != 2) {
-                        sum = 0.0;
-                        for (r = 0; r < q.n; r++) {
-                            sum += q.w[r] * aquad[r]
-                                       * InnerProd(gradpsi[l],gradpsi[m]);
-                        }
-                        v[cv] = fabs(detJ) * sum;
+                        v[cv] = Ke[l][m];
                         cv++;
                     }
                 }
             }
         }
         // insert element stiffness matrix
-        ierr = MatSetValues(P,cr,row,cr,row,v,ADD_VALUES); CHKERRQ(ierr);
+        ierr = MatSetValuesLocal(P,cr,row,cc,col,v,ADD_VALUES); CHKERRQ(ierr);
     }
     ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
     ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
-    ierr = VecRestoreArrayRead(u,&au); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(user->uloc,&au); CHKERRQ(ierr);
     ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
 
     ierr = MatAssemblyBegin(P,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
@@ -262,48 +993,520 @@ PetscErrorCode FormPicard(SNES snes, Vec u, Mat A, Mat P, void *ctx) {
     return 0;
 }
 
-/* In this procedure, note that nnz[n] is the number of nonzeros in row n.
-It is one for Dirichlet rows.  It is one more than the vertex degree for
-interior points, and two more for Neumann nodes. */
+/* Matrix-free (-un_matfree) version of the Picard or Newton operator.  At
+each Jacobian evaluation only the coefficients at quadrature points are
+stored, along with the diagonal of the operator for PCJACOBI.  The action of
+the operator is computed element-by-element in MatMult_MatFree(). */
+static PetscErrorCode FormMatFree(Vec u, Mat A, unfemCtx *user,
+                                  PetscBool newton) {
+    PetscErrorCode ierr;
+    const Quad2DTri q = symmgauss[user->quaddegree-1];
+    const int       *abfn, *ae, *en;
+    const Node      *aloc;
+    const double    *au;
+    double          unode[3], gradpsi[3][2], xq[MAXPTS_TRI], yq[MAXPTS_TRI],
+                    Ke[3][3], absdetJ,
+                    *adiag, *aq, *daq = NULL, *dfq = NULL, *gu = NULL;
+    int             n, k, l;
+
+    PetscLogStagePush(user->jacstage);  //STRIP
+    user->mfnewton = newton;
+    ierr = VecScatterBegin(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecGetArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = VecGetArray(user->mfdiag,&adiag); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < user->mesh->Nown; n++)
+        adiag[n] = (abfn[n] == 2) ? 1.0 : 0.0;
+    ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    for (k = 0; k < user->mesh->K; k++) {
+        en = ae + 3*k;
+        ElementGeometry(user->mesh,aloc,en,k,&q,&absdetJ,gradpsi,xq,yq);
+        ElementU(user,abfn,au,en,unode);
+        aq = user->mfa + q.n * k;
+        if (newton) {
+            daq = user->mfdadu + q.n * k;
+            dfq = user->mfdfdu + q.n * k;
+            gu = user->mfgradu + 2 * k;
+        }
+        ElementCoefficients(user,&q,unode,gradpsi,xq,yq,newton,aq,daq,dfq,gu);
+        ElementMatrix(&q,absdetJ,gradpsi,aq,newton,daq,dfq,gu,Ke);
+        for (l = 0; l < 3; l++) {
+            if (en[l] < user->mesh->Nown && abfn[en[l]] != 2)
+                adiag[en[l]] += Ke[l][l];
+        }
+    }
+    ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArray(user->mfdiag,&adiag); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = MatAssemblyBegin(A,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    ierr = MatAssemblyEnd(A,MAT_FINAL_ASSEMBLY); CHKERRQ(ierr);
+    PetscLogStagePop();  //STRIP
+    return 0;
+}
+
+// y = A v  where A is the operator linearized at the last FormMatFree()
+PetscErrorCode MatMult_MatFree(Mat A, Vec v, Vec y) {
+    PetscErrorCode ierr;
+    unfemCtx        *user;
+    Quad2DTri       q;
+    const int       *abfn, *ae, *en;
+    const Node      *aloc;
+    const double    *av, *aq, *daq = NULL, *dfq = NULL, *gu = NULL;
+    double          *ay, gradpsi[3][2], xq[MAXPTS_TRI], yq[MAXPTS_TRI],
+                    Ke[3][3], absdetJ, sum;
+    int             n, k, l, m;
+
+    ierr = MatShellGetContext(A,&user); CHKERRQ(ierr);
+    q = symmgauss[user->quaddegree-1];
+    ierr = VecScatterBegin(user->ltog,v,user->vloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(user->ltog,v,user->vloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecGetArrayRead(user->vloc,&av); CHKERRQ(ierr);
+    ierr = VecGetArray(y,&ay); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    for (n = 0; n < user->mesh->Nown; n++)   // Dirichlet rows are identity
+        ay[n] = (abfn[n] == 2) ? av[n] : 0.0;
+    ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    for (k = 0; k < user->mesh->K; k++) {
+        en = ae + 3*k;
+        ElementGeometry(user->mesh,aloc,en,k,&q,&absdetJ,gradpsi,xq,yq);
+        aq = user->mfa + q.n * k;
+        if (user->mfnewton) {
+            daq = user->mfdadu + q.n * k;
+            dfq = user->mfdfdu + q.n * k;
+            gu = user->mfgradu + 2 * k;
+        }
+        ElementMatrix(&q,absdetJ,gradpsi,aq,user->mfnewton,daq,dfq,gu,Ke);
+        // same rows and columns as in FormPicardOrNewton()
+        for (l = 0; l < 3; l++) {
+            if (en[l] < user->mesh->Nown && abfn[en[l]] != 2) {
+                sum = 0.0;
+                for (m = 0; m < 3; m++) {
+                    if (abfn[en[m]] != 2)
+                        sum += Ke[l][m] * av[en[m]];
+                }
+                ay[en[l]] += sum;
+            }
+        }
+    }
+    ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArray(y,&ay); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(user->vloc,&av); CHKERRQ(ierr);
+    return 0;
+}
+
+PetscErrorCode MatGetDiagonal_MatFree(Mat A, Vec d) {
+    PetscErrorCode ierr;
+    unfemCtx       *user;
+    ierr = MatShellGetContext(A,&user); CHKERRQ(ierr);
+    ierr = VecCopy(user->mfdiag,d); CHKERRQ(ierr);
+    return 0;
+}
+
+// context for coarse level l:  as user, but on the coarse mesh, and without
+// the options which apply only to the finest level
+static void MGLevelCtx(const unfemCtx *user, int l, unfemCtx *lev) {
+    *lev = *user;
+    lev->mesh = &(user->mg->mesh[l]);
+    lev->gDnode = user->mg->gDnode[l];
+    lev->uloc = user->mg->uloc[l];
+    lev->ltog = user->mg->ltog[l];
+    lev->usecsrslots = PETSC_FALSE;
+    lev->csrslot = NULL;
+    lev->mfa = NULL;
+    lev->p2 = NULL;
+    lev->mg = NULL;
+}
+
+/* Rediscretize the Picard operator on each coarse level, using the current
+iterate at the coarse nodes, which are the first nodes of the finest mesh.
+Coarse operators are Picard even when the Newton Jacobian is used on the
+finest level.  */
+static PetscErrorCode MGFormCoarse(Vec u, unfemCtx *user) {
+    PetscErrorCode ierr;
+    unfemCtx  lev;
+    Vec       ul;
+    int       l;
+    for (l = 0; l < user->mg->nlevels-1; l++) {
+        MGLevelCtx(user,l,&lev);
+        ierr = VecGetSubVector(u,user->mg->inject[l],&ul); CHKERRQ(ierr);
+        ierr = FormPicardOrNewton(ul,user->mg->A[l],user->mg->A[l],&lev,PETSC_FALSE); CHKERRQ(ierr);
+        ierr = VecRestoreSubVector(u,user->mg->inject[l],&ul); CHKERRQ(ierr);
+    }
+    return 0;
+}
+
+PetscErrorCode FormPicard(SNES snes, Vec u, Mat A, Mat P, void *ctx) {
+    PetscErrorCode ierr;
+    unfemCtx *user = (unfemCtx*)ctx;
+    if (user->p2)
+        return FormPicardOrNewtonP2(u,A,P,user,PETSC_FALSE);
+    if (user->mfa)
+        return FormMatFree(u,A,user,PETSC_FALSE);
+    ierr = FormPicardOrNewton(u,A,P,user,PETSC_FALSE); CHKERRQ(ierr);
+    if (user->mg) {
+        ierr = MGFormCoarse(u,user); CHKERRQ(ierr);
+    }
+    return 0;
+}
+
+PetscErrorCode FormNewton(SNES snes, Vec u, Mat A, Mat P, void *ctx) {
+    PetscErrorCode ierr;
+    unfemCtx *user = (unfemCtx*)ctx;
+    if (user->p2)
+        return FormPicardOrNewtonP2(u,A,P,user,PETSC_TRUE);
+    if (user->mfa)
+        return FormMatFree(u,A,user,PETSC_TRUE);
+    ierr = FormPicardOrNewton(u,A,P,user,PETSC_TRUE); CHKERRQ(ierr);
+    if (user->mg) {
+        ierr = MGFormCoarse(u,user); CHKERRQ(ierr);
+    }
+    return 0;
+}
+
+/* In this procedure, note that nnz[n] = dnnz[n] + onnz[n] is the number of
+nonzeros in (owned) row n.  It is one for Dirichlet rows.  Otherwise it is one
+more than the vertex degree, i.e. the number of neighbors.  Neighbors which
+are owned go in the diagonal block (dnnz) and ghosts go in the off-diagonal
+block (onnz). */
 //STARTPREALLOC
 PetscErrorCode Preallocation(Mat J, unfemCtx *user) {
     PetscErrorCode ierr;
-    const int    *abfn, *ae, *en;
-    int          *nnz, n, k, l;
+    const int    *abfn;
+    int          *ia, *ja, *dnnz, *onnz, n, j;
 
-    nnz = (int *)malloc(sizeof(int)*(user->mesh->N));
+    ierr = UMNodeAdjacency(user->mesh,&ia,&ja); CHKERRQ(ierr);
+    dnnz = (int *)malloc(sizeof(int)*(user->mesh->Nown));
+    onnz = (int *)malloc(sizeof(int)*(user->mesh->Nown));
     ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
-    for (n = 0; n < user->mesh->N; n++)
-        nnz[n] = (abfn[n] == 1) ? 2 : 1;
+    for (n = 0; n < user->mesh->Nown; n++) {
+        dnnz[n] = 1;
+        onnz[n] = 0;
+        if (abfn[n] == 2)
+            continue;
+        for (j = ia[n]; j < ia[n+1]; j++) {
+            if (ja[j] < user->mesh->Nown)
+                dnnz[n] += 1;
+            else
+                onnz[n] += 1;
+        }
+    }
+    ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+    ierr = PetscFree(ia); CHKERRQ(ierr);
+    ierr = PetscFree(ja); CHKERRQ(ierr);
+    ierr = MatSeqAIJSetPreallocation(J,-1,dnnz); CHKERRQ(ierr);
+    ierr = MatMPIAIJSetPreallocation(J,-1,dnnz,-1,onnz); CHKERRQ(ierr);
+    free(dnnz);  free(onnz);
+    return 0;
+}
+//ENDPREALLOC
+
+/* Refine the whole mesh nlevels-1 times by UMRefineUniform().  On return
+*mesh is the finest mesh, on which the problem is solved, and the coarser
+meshes, and the interpolations between them, are in user->mg.  */
+PetscErrorCode MGCreateHierarchy(UM *mesh, unfemCtx *user, int nlevels) {
+    PetscErrorCode ierr;
+    MGHierarchy *mg;
+    UM          fine;
+    int         l;
+    ierr = PetscNew(&mg); CHKERRQ(ierr);
+    mg->nlevels = nlevels;
+    ierr = PetscMalloc1(nlevels-1,&(mg->mesh)); CHKERRQ(ierr);
+    ierr = PetscCalloc1(nlevels,&(mg->P)); CHKERRQ(ierr);
+    for (l = 0; l < nlevels-1; l++) {
+        mg->mesh[l] = *mesh;  // coarse level takes the Vec and ISs
+        ierr = UMRefineUniform(&(mg->mesh[l]),&fine,&(mg->P[l+1])); CHKERRQ(ierr);
+        *mesh = fine;
+    }
+    mg->A = NULL;
+    mg->inject = NULL;
+    mg->gDnode = NULL;
+    mg->uloc = NULL;
+    mg->ltog = NULL;
+    user->mg = mg;
+    return 0;
+}
+
+// distribute coarse meshes (i.e. in serial) and create coarse operators
+PetscErrorCode MGSetupLevels(unfemCtx *user, Vec u) {
+    PetscErrorCode ierr;
+    MGHierarchy *mg = user->mg;
+    unfemCtx    lev;
+    Vec         ul;
+    int         l, L = mg->nlevels - 1;
+    ierr = PetscMalloc1(L,&(mg->A)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(L,&(mg->inject)); CHKERRQ(ierr);
+    ierr = PetscCalloc1(L,&(mg->gDnode)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(L,&(mg->uloc)); CHKERRQ(ierr);
+    ierr = PetscMalloc1(L,&(mg->ltog)); CHKERRQ(ierr);
+    for (l = 0; l < L; l++) {
+        UM *cm = &(mg->mesh[l]);
+        ierr = UMDistribute(cm,PETSC_COMM_WORLD); CHKERRQ(ierr);
+        ierr = ISCreateStride(PETSC_COMM_WORLD,cm->N,0,1,&(mg->inject[l])); CHKERRQ(ierr);
+        ierr = VecGetSubVector(u,mg->inject[l],&ul); CHKERRQ(ierr);
+        ierr = UMCreateGlobalToLocal(cm,ul,&(mg->uloc[l]),&(mg->ltog[l])); CHKERRQ(ierr);
+        ierr = VecRestoreSubVector(u,mg->inject[l],&ul); CHKERRQ(ierr);
+        MGLevelCtx(user,l,&lev);
+        ierr = FillDirichlet(&lev); CHKERRQ(ierr);
+        mg->gDnode[l] = lev.gDnode;
+        ierr = MatCreate(PETSC_COMM_WORLD,&(mg->A[l])); CHKERRQ(ierr);
+        ierr = MatSetSizes(mg->A[l],cm->Nown,cm->Nown,cm->Nglobal,cm->Nglobal); CHKERRQ(ierr);
+        ierr = MatSetFromOptions(mg->A[l]); CHKERRQ(ierr);
+        ierr = MatSetOption(mg->A[l],MAT_SYMMETRIC,PETSC_TRUE); CHKERRQ(ierr);
+        ierr = Preallocation(mg->A[l],&lev); CHKERRQ(ierr);
+        ierr = MatSetLocalToGlobalMapping(mg->A[l],cm->ltog,cm->ltog); CHKERRQ(ierr);
+    }
+    return 0;
+}
+
+PetscErrorCode MGDestroy(MGHierarchy **mg) {
+    int l;
+    if (!(*mg))
+        return 0;
+    for (l = 0; l < (*mg)->nlevels-1; l++) {
+        UMDestroy(&((*mg)->mesh[l]));
+        if ((*mg)->A) {
+            MatDestroy(&((*mg)->A[l]));
+            ISDestroy(&((*mg)->inject[l]));
+            PetscFree((*mg)->gDnode[l]);
+            VecDestroy(&((*mg)->uloc[l]));
+            VecScatterDestroy(&((*mg)->ltog[l]));
+        }
+    }
+    for (l = 1; l < (*mg)->nlevels; l++)
+        MatDestroy(&((*mg)->P[l]));
+    PetscFree((*mg)->mesh);
+    PetscFree((*mg)->P);
+    PetscFree((*mg)->A);
+    PetscFree((*mg)->inject);
+    PetscFree((*mg)->gDnode);
+    PetscFree((*mg)->uloc);
+    PetscFree((*mg)->ltog);
+    PetscFree(*mg);
+    *mg = NULL;
+    return 0;
+}
+
+/* Residual a posteriori error estimate for P1, squared, on each element:
+    eta_K^2 = h_K^2 |K| f^2 + sum_e w_e h_e^2 R_e^2
+where f is evaluated at the centroid, and R_e is the jump of the normal flux
+a(u) grad u . n across edge e of K, or g_N - a(u) grad u . n on a Neumann
+segment, at the midpoint of e.  The weight w_e is 1/2 for interior edges
+(shared with the neighbor) and 1 for Neumann segments; Dirichlet segments do
+not contribute.  For P1 the term div(a grad u) inside K is dropped; it is zero
+when a is constant.  Whole mesh, so serial only.  */
+PetscErrorCode ErrorEstimate(Vec u, unfemCtx *user, double *eta2) {
+    PetscErrorCode ierr;
+    const Quad2DTri q = symmgauss[user->quaddegree-1];
+    const int       *ae, *abfn, *as, *abfs, *en;
+    const Node      *aloc;
+    const double    *au;
+    double          *flux, *wt, unode[3], gradpsi[3][2], gradu[2],
+                    xq[MAXPTS_TRI], yq[MAXPTS_TRI], absdetJ,
+                    dx, dy, le, hK, nx, ny, xm, ym, am;
+    int             *ke, *sedge, E, k, l, j, p, na, nb, nc;
+
+    ierr = VecScatterBegin(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = VecScatterEnd(user->ltog,u,user->uloc,INSERT_VALUES,SCATTER_FORWARD); CHKERRQ(ierr);
+    ierr = UMCreateEdges(user->mesh,&E,&ke,&sedge); CHKERRQ(ierr);
+    ierr = PetscCalloc1(E,&flux); CHKERRQ(ierr);
+    ierr = PetscMalloc1(E,&wt); CHKERRQ(ierr);
+    for (j = 0; j < E; j++)
+        wt[j] = 0.5;
+    ierr = VecGetArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = UMGetNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
     ierr = ISGetIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
+
+    // element residuals, and outward normal fluxes summed on each edge
     for (k = 0; k < user->mesh->K; k++) {
-        en = ae + 3*k;  // en[0], en[1], en[2] are nodes of element k
-        for (l = 0; l < 3; l++)
-            if (abfn[en[l]] != 2)
-                nnz[en[l]] += 1;
+        en = ae + 3*k;
+        ElementGeometry(user->mesh,aloc,en,k,&q,&absdetJ,gradpsi,xq,yq);
+        ElementU(user,abfn,au,en,unode);
+        gradu[0] = 0.0;  gradu[1] = 0.0;
+        for (l = 0; l < 3; l++) {
+            gradu[0] += unode[l] * gradpsi[l][0];
+            gradu[1] += unode[l] * gradpsi[l][1];
+        }
+        hK = 0.0;
+        for (l = 0; l < 3; l++) {
+            na = en[l];
+            nb = en[(l+1)%3];
+            nc = en[(l+2)%3];
+            dx = aloc[nb].x - aloc[na].x;
+            dy = aloc[nb].y - aloc[na].y;
+            le = sqrt(dx * dx + dy * dy);
+            hK = PetscMax(hK,le);
+            nx = dy / le;
+            ny = - dx / le;
+            if (nx * (aloc[nc].x - aloc[na].x) + ny * (aloc[nc].y - aloc[na].y) > 0.0) {
+                nx = - nx;
+                ny = - ny;
+            }
+            xm = 0.5 * (aloc[na].x + aloc[nb].x);
+            ym = 0.5 * (aloc[na].y + aloc[nb].y);
+            am = user->a_fcn(0.5 * (unode[l] + unode[(l+1)%3]),xm,ym);
+            flux[ke[3*k+l]] += am * (gradu[0] * nx + gradu[1] * ny);
+        }
+        xm = (aloc[en[0]].x + aloc[en[1]].x + aloc[en[2]].x) / 3.0;
+        ym = (aloc[en[0]].y + aloc[en[1]].y + aloc[en[2]].y) / 3.0;
+        am = user->f_fcn((unode[0] + unode[1] + unode[2]) / 3.0,xm,ym);
+        eta2[k] = hK * hK * 0.5 * absdetJ * am * am;
+    }
+
+    // on boundary segments, flux sums are from one element only
+    ierr = ISGetIndices(user->mesh->s,&as); CHKERRQ(ierr);
+    ierr = ISGetIndices(user->mesh->bfs,&abfs); CHKERRQ(ierr);
+    for (p = 0; p < user->mesh->P; p++) {
+        j = sedge[p];
+        if (abfs[p] == 1) {
+            xm = 0.5 * (aloc[as[2*p]].x + aloc[as[2*p+1]].x);
+            ym = 0.5 * (aloc[as[2*p]].y + aloc[as[2*p+1]].y);
+            flux[j] = user->gN_fcn(xm,ym) - flux[j];
+            wt[j] = 1.0;
+        } else {
+            wt[j] = 0.0;
+        }
+    }
+    ierr = ISRestoreIndices(user->mesh->bfs,&abfs); CHKERRQ(ierr);
+    ierr = ISRestoreIndices(user->mesh->s,&as); CHKERRQ(ierr);
+
+    // edge residuals
+    for (k = 0; k < user->mesh->K; k++) {
+        for (l = 0; l < 3; l++) {
+            na = ae[3*k+l];
+            nb = ae[3*k+(l+1)%3];
+            dx = aloc[nb].x - aloc[na].x;
+            dy = aloc[nb].y - aloc[na].y;
+            j = ke[3*k+l];
+            eta2[k] += wt[j] * (dx * dx + dy * dy) * flux[j] * flux[j];
+        }
     }
     ierr = ISRestoreIndices(user->mesh->e,&ae); CHKERRQ(ierr);
+
     ierr = ISRestoreIndices(user->mesh->bfn,&abfn); CHKERRQ(ierr);
-    ierr = MatSeqAIJSetPreallocation(J,-1,nnz); CHKERRQ(ierr);
-    free(nnz);
+    ierr = UMRestoreNodeCoordArrayRead(user->mesh,&aloc); CHKERRQ(ierr);
+    ierr = VecRestoreArrayRead(user->uloc,&au); CHKERRQ(ierr);
+    ierr = PetscFree(flux); CHKERRQ(ierr);
+    ierr = PetscFree(wt); CHKERRQ(ierr);
+    ierr = PetscFree(ke); CHKERRQ(ierr);
+    ierr = PetscFree(sedge); CHKERRQ(ierr);
+    return 0;
+}
+
+/* Dorfler (bulk) marking:  mark a smallest set of elements, those with the
+largest estimates, whose sum of eta_K^2 is at least theta times the total.  */
+PetscErrorCode DorflerMark(int K, const double *eta2, double theta,
+                           PetscBool *marked) {
+    PetscErrorCode ierr;
+    int    *perm, k;
+    double total = 0.0, sum = 0.0;
+    ierr = PetscMalloc1(K,&perm); CHKERRQ(ierr);
+    for (k = 0; k < K; k++) {
+        perm[k] = k;
+        total += eta2[k];
+        marked[k] = PETSC_FALSE;
+    }
+    ierr = PetscSortRealWithPermutation(K,eta2,perm); CHKERRQ(ierr);
+    for (k = K-1; k >= 0 && sum < theta * total; k--) {
+        marked[perm[k]] = PETSC_TRUE;
+        sum += eta2[perm[k]];
+    }
+    ierr = PetscFree(perm); CHKERRQ(ierr);
+    return 0;
+}
+
+// versions of FormFunction() and the Jacobian which accumulate times and
+// element counts; used only with -un_perf_summary
+PetscErrorCode FormFunctionTimed(SNES snes, Vec u, Vec F, void *ctx) {
+    PetscErrorCode ierr;
+    unfemCtx       *user = (unfemCtx*)ctx;
+    PetscLogDouble t0, t1;
+    ierr = PetscTime(&t0); CHKERRQ(ierr);
+    ierr = FormFunction(snes,u,F,ctx); CHKERRQ(ierr);
+    ierr = PetscTime(&t1); CHKERRQ(ierr);
+    user->perf.restime += t1 - t0;
+    user->perf.reselts += user->mesh->K;
+    user->perf.rescount++;
+    return 0;
+}
+
+PetscErrorCode FormJacobianTimed(SNES snes, Vec u, Mat A, Mat P, void *ctx) {
+    PetscErrorCode ierr;
+    unfemCtx       *user = (unfemCtx*)ctx;
+    PetscLogDouble t0, t1;
+    ierr = PetscTime(&t0); CHKERRQ(ierr);
+    ierr = (*(user->perf.jacfcn))(snes,u,A,P,ctx); CHKERRQ(ierr);
+    ierr = PetscTime(&t1); CHKERRQ(ierr);
+    user->perf.jactime += t1 - t0;
+    user->perf.jacelts += user->mesh->K;
+    user->perf.jaccount++;
+    return 0;
+}
+
+/* Times are the maximum over processes, and bytes and elements are summed, so
+rates are for the whole run.  Elements are counted on the finest level only
+(i.e. not on coarse levels with -un_mg_levels), and elements which touch
+nodes owned by several processes are counted on each.  */
+PetscErrorCode PerfSummaryView(unfemCtx *user, PetscLogDouble bytesread) {
+    PetscErrorCode ierr;
+    PetscLogDouble ltime[3], gtime[3];
+    double         lsum[3], gsum[3];
+    ltime[0] = user->perf.readtime;
+    ltime[1] = user->perf.restime;
+    ltime[2] = user->perf.jactime;
+    lsum[0] = bytesread;
+    lsum[1] = user->perf.reselts;
+    lsum[2] = user->perf.jacelts;
+    ierr = MPI_Allreduce(ltime,gtime,3,MPI_DOUBLE,MPI_MAX,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = MPI_Allreduce(lsum,gsum,3,MPI_DOUBLE,MPI_SUM,PETSC_COMM_WORLD); CHKERRQ(ierr);
+    ierr = PetscPrintf(PETSC_COMM_WORLD,
+               "performance summary (see -log_view for UM events):\n"
+               "  load mesh:  %.3f MB in %.4f s = %.2f MB/s\n"
+               "  residual:   %d evaluations, %.3e elements in %.4f s = %.3e elements/s\n"
+               "  Jacobian:   %d evaluations, %.3e elements in %.4f s = %.3e elements/s\n",
+               gsum[0] / 1.0e6, gtime[0], (gtime[0] > 0.0) ? gsum[0] / 1.0e6 / gtime[0] : 0.0,
+               user->perf.rescount, gsum[1], gtime[1], (gtime[1] > 0.0) ? gsum[1] / gtime[1] : 0.0,
+               user->perf.jaccount, gsum[2], gtime[2], (gtime[2] > 0.0) ? gsum[2] / gtime[2] : 0.0); CHKERRQ(ierr);
     return 0;
 }
-//ENDPREALLOC
 
 int main(int argc,char **argv) {
     PetscErrorCode ierr;
     PetscBool   view = PETSC_FALSE,
                 viewsoln = PETSC_FALSE,
-                noprealloc = PETSC_FALSE;
-    char        root[256] = "", nodesname[256], issname[256], solnname[256];
-    UM          mesh;
+                viewvtk = PETSC_FALSE,
+                perfsummary = PETSC_FALSE,
+                noprealloc = PETSC_FALSE,
+                nogeometry = PETSC_FALSE,
+                matfree = PETSC_FALSE,
+                writecompact = PETSC_FALSE,
+                color = PETSC_FALSE,
+                csrslots = PETSC_FALSE,
+                qset;
+    int         order = 1, Ndof, Ndofglobal, mglevels = 1, l,
+                adaptsteps = 0, adaptmaxnodes = 0, step;
+    JacobianType jac = PICARD;
+    MeshFormatType meshformat = PETSCBINARY;
+    UMReorderType reorder = UM_REORDER_NONE;
+    char        root[256] = "", nodesname[256], issname[256], solnname[256],
+                compactname[256];
+    UM          mesh, fine;
     unfemCtx    user;
     SNES        snes;
     KSP         ksp;
     PC          pc;
     Mat         A;
-    Vec         r, u, uexact;
-    double      err, h_max;
+    Vec         r, u, uexact, uinit = NULL;
+    PetscMPIInt rank, size;
+    double      err, h_max, adapttheta = 0.5, adapttol = 0.0;
+    PetscLogDouble t0, t1, bytesread;
 
     PetscInitialize(&argc,&argv,NULL,help);
     ierr = PetscLogStageRegister("Read mesh      ", &user.readstage); CHKERRQ(ierr);  //STRIP
@@ -314,30 +1517,104 @@ int main(int argc,char **argv) {
 
     user.quaddegree = 1;
     user.solncase = 0;
+    user.p2 = NULL;
+    user.mg = NULL;
+    ierr = PetscMemzero(&(user.perf),sizeof(PerfSummary)); CHKERRQ(ierr);
     ierr = PetscOptionsBegin(PETSC_COMM_WORLD, "un_", "options for unfem", ""); CHKERRQ(ierr);
     ierr = PetscOptionsInt("-case",
            "exact solution cases: 0=linear, 1=nonlinear, 2=nonhomoNeumann, 3=chapter3, 4=koch",
            "unfem.c",user.solncase,&(user.solncase),NULL); CHKERRQ(ierr);
     ierr = PetscOptionsString("-mesh",
-           "file name root of mesh stored in PETSc binary with .vec,.is extensions",
+           "file name root of mesh; see -un_mesh_format for extensions",
            "unfem.c",root,root,sizeof(root),NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsEnum("-mesh_format",
+           "format of mesh files: petsc (root.vec,root.is from tri2petsc.py), triangle (root.node,root.ele,root.poly), or compact (root.um; see -un_write_compact)",
+           "unfem.c",MeshFormatTypes,(PetscEnum)meshformat,(PetscEnum*)&meshformat,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsEnum("-reorder",
+           "renumber nodes and elements after reading mesh: none, rcm (reverse Cuthill-McKee), or hilbert (space-filling curve)",
+           "unfem.c",UMReorderTypes,(PetscEnum)reorder,(PetscEnum*)&reorder,NULL); CHKERRQ(ierr);
     ierr = PetscOptionsInt("-quaddegree",
-           "quadrature degree (1,2,3)",
-           "unfem.c",user.quaddegree,&(user.quaddegree),NULL); CHKERRQ(ierr);
+           "quadrature degree (1,...,5) on elements, also selecting the Gauss-Legendre rule on Neumann segments; default is 1 for P1 and 4 for P2",
+           "unfem.c",user.quaddegree,&(user.quaddegree),&qset); CHKERRQ(ierr);
+    ierr = PetscOptionsInt("-order",
+           "polynomial degree of elements: 1 (P1) or 2 (P2; serial only)",
+           "unfem.c",order,&order,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsInt("-mg_levels",
+           "refine the mesh uniformly to get this many levels, solve on the finest, and precondition by PCMG with rediscretized Picard operators (serial only)",
+           "unfem.c",mglevels,&mglevels,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsInt("-adapt_steps",
+           "number of adaptive refinements, each by error estimate, Dorfler marking, longest-edge bisection, and solve from the transferred solution (serial only)",
+           "unfem.c",adaptsteps,&adaptsteps,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsReal("-adapt_theta",
+           "Dorfler marking fraction in (0,1]:  refine elements with this fraction of the total squared error estimate",
+           "unfem.c",adapttheta,&adapttheta,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsReal("-adapt_tol",
+           "stop adaptive refinement when the error estimate is below this",
+           "unfem.c",adapttol,&adapttol,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsInt("-adapt_max_nodes",
+           "stop adaptive refinement when the mesh has at least this many nodes (if positive)",
+           "unfem.c",adaptmaxnodes,&adaptmaxnodes,NULL); CHKERRQ(ierr);
     ierr = PetscOptionsBool("-view",
            "view loaded nodes and elements at stdout",
            "unfem.c",view,&view,NULL); CHKERRQ(ierr);
     ierr = PetscOptionsBool("-view_solution",
            "view solution u(x,y) to binary file; uses root name of mesh plus .soln\nsee petsc2tricontour.py to view graphically",
            "unfem.c",viewsoln,&viewsoln,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-perf_summary",
+           "print MB/s for loading the mesh, and elements/s for residual and Jacobian evaluations",
+           "unfem.c",perfsummary,&perfsummary,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-view_vtk",
+           "write mesh and solution u(x,y) for ParaView:  root.vtu, or root.pvtu plus root_<rank>.vtu in parallel",
+           "unfem.c",viewvtk,&viewvtk,NULL); CHKERRQ(ierr);
     ierr = PetscOptionsBool("-noprealloc",
            "do not perform preallocation before matrix assembly",
            "unfem.c",noprealloc,&noprealloc,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsEnum("-jacobian",
+           "Jacobian used by SNES: picard (symmetric, a(u) frozen) or newton (exact derivative)",
+           "unfem.c",JacobianTypes,(PetscEnum)jac,(PetscEnum*)&jac,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-color",
+           "color elements and assemble each color with OpenMP threads (if built with OpenMP); serial matrices get values directly in CSR; uncolored if more than 64 colors are needed (see -info)",
+           "unfem.c",color,&color,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-csrslots",
+           "in serial, precompute offsets of element matrix entries into the CSR values of the assembled matrix, and add into them directly",
+           "unfem.c",csrslots,&csrslots,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-matfree",
+           "apply Picard/Newton operator matrix-free, element-by-element; preconditioner is PCJACOBI",
+           "unfem.c",matfree,&matfree,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-write_compact",
+           "write the mesh, its partition for this number of processes, and (unless -un_nogeometry) its geometry to root.um for -un_mesh_format compact",
+           "unfem.c",writecompact,&writecompact,NULL); CHKERRQ(ierr);
+    ierr = PetscOptionsBool("-nogeometry",
+           "do not cache element geometry; recompute it in each residual and Jacobian evaluation",
+           "unfem.c",nogeometry,&nogeometry,NULL); CHKERRQ(ierr);
     ierr = PetscOptionsEnd(); CHKERRQ(ierr);
+    if ((order < 1) || (order > 2)) {
+        SETERRQ(PETSC_COMM_WORLD,2,"only -un_order 1 or 2 is implemented");
+    }
+    if ((user.quaddegree < 1) || (user.quaddegree > 5)) {
+        SETERRQ1(PETSC_COMM_WORLD,10,"-un_quaddegree %d not allowed; 1 <= quaddegree <= 5 required",
+                 user.quaddegree);
+    }
+    if (order == 2 && !qset)
+        user.quaddegree = 4;  // exact for P2 stiffness with a(u) quadratic
+    if (order == 2 && matfree) {
+        SETERRQ(PETSC_COMM_WORLD,3,"-un_matfree is implemented only for P1");
+    }
+    if (mglevels < 1) {
+        SETERRQ(PETSC_COMM_WORLD,5,"-un_mg_levels must be positive");
+    }
+    if (mglevels > 1 && (order == 2 || matfree)) {
+        SETERRQ(PETSC_COMM_WORLD,6,"-un_mg_levels is implemented only for assembled P1");
+    }
+    if (adaptsteps > 0 && (order == 2 || matfree || mglevels > 1)) {
+        SETERRQ(PETSC_COMM_WORLD,8,"-un_adapt_steps is implemented only for assembled P1 without -un_mg_levels");
+    }
 
     // set parameters and exact solution
     user.a_fcn = &a_lin;
     user.f_fcn = &f_lin;
+    user.dadu_fcn = &dadu_lin;
+    user.dfdu_fcn = &dfdu_lin;
     user.uexact_fcn = &uexact_lin;
     user.gD_fcn = &gD_lin;
     user.gN_fcn = &gN_lin;
@@ -347,6 +1624,8 @@ int main(int argc,char **argv) {
         case 1 :
             user.a_fcn = &a_nonlin;
             user.f_fcn = &f_nonlin;
+            user.dadu_fcn = &dadu_nonlin;
+            user.dfdu_fcn = &dfdu_nonlin;
             break;
         case 2 :
             user.gN_fcn = &gN_linneu;
@@ -374,13 +1653,52 @@ int main(int argc,char **argv) {
     strncat(nodesname, ".vec", 4);
     strcpy(issname, root);
     strncat(issname, ".is", 3);
+    strcpy(compactname, root);
+    strncat(compactname, ".um", 3);
 
 //STARTMAININITIAL
     PetscLogStagePush(user.readstage);  //STRIP
     // read mesh object of type UM
     ierr = UMInitialize(&mesh); CHKERRQ(ierr);
-    ierr = UMReadNodes(&mesh,nodesname); CHKERRQ(ierr);
-    ierr = UMReadISs(&mesh,issname); CHKERRQ(ierr);
+    ierr = MPI_Comm_rank(PETSC_COMM_WORLD,&rank); CHKERRQ(ierr);
+    ierr = MPI_Comm_size(PETSC_COMM_WORLD,&size); CHKERRQ(ierr);
+    if (order == 2 && size > 1) {
+        SETERRQ(PETSC_COMM_WORLD,4,"-un_order 2 is implemented only in serial");
+    }
+    if (mglevels > 1 && size > 1) {
+        SETERRQ(PETSC_COMM_WORLD,7,"-un_mg_levels is implemented only in serial");
+    }
+    if (adaptsteps > 0 && size > 1) {
+        SETERRQ(PETSC_COMM_WORLD,9,"-un_adapt_steps is implemented only in serial");
+    }
+    ierr = PetscTime(&t0); CHKERRQ(ierr);
+    if (meshformat == TRIANGLE) {
+        ierr = UMReadTriangle(&mesh,root); CHKERRQ(ierr);
+    } else if (meshformat == COMPACT) {
+        ierr = UMReadCompact(&mesh,compactname); CHKERRQ(ierr);
+    } else {
+        ierr = UMReadNodes(&mesh,nodesname); CHKERRQ(ierr);
+        ierr = UMReadISs(&mesh,issname); CHKERRQ(ierr);
+    }
+    ierr = PetscTime(&t1); CHKERRQ(ierr);
+    user.perf.readtime = t1 - t0;
+    bytesread = mesh.bytesread;
+    ierr = UMReorder(&mesh,reorder); CHKERRQ(ierr);
+    if (writecompact) {
+        if (size > 1) {
+            ierr = UMPartition(&mesh,PETSC_COMM_WORLD); CHKERRQ(ierr);
+        }
+        if (!nogeometry) {  // only reused in serial runs
+            ierr = UMCreateGeometry(&mesh,user.quaddegree); CHKERRQ(ierr);
+        }
+        if (rank == 0) {
+            ierr = UMWriteCompact(&mesh,compactname); CHKERRQ(ierr);
+        }
+    }
+    if (mglevels > 1) {
+        ierr = MGCreateHierarchy(&mesh,&user,mglevels); CHKERRQ(ierr);
+    }
+    ierr = UMDistribute(&mesh,PETSC_COMM_WORLD); CHKERRQ(ierr);
     ierr = UMStats(&mesh, &h_max, NULL, NULL, NULL); CHKERRQ(ierr);
     if (view) {  //STRIP
         PetscViewer stdoutviewer;  //STRIP
@@ -390,65 +1708,219 @@ int main(int argc,char **argv) {
     user.mesh = &mesh;
     PetscLogStagePop();  //STRIP
 
-    // configure Vecs and SNES
-    PetscLogStagePush(user.setupstage);  //STRIP
-    ierr = VecCreate(PETSC_COMM_WORLD,&r); CHKERRQ(ierr);
-    ierr = VecSetSizes(r,PETSC_DECIDE,mesh.N); CHKERRQ(ierr);
-    ierr = VecSetFromOptions(r); CHKERRQ(ierr);
-    ierr = VecDuplicate(r,&u); CHKERRQ(ierr);
-    ierr = VecSet(u,0.0); CHKERRQ(ierr);
-    ierr = SNESCreate(PETSC_COMM_WORLD,&snes); CHKERRQ(ierr);
-    ierr = SNESSetFunction(snes,r,FormFunction,&user); CHKERRQ(ierr);
-
-    // reset default KSP and PC
-    ierr = SNESGetKSP(snes,&ksp); CHKERRQ(ierr);
-    ierr = KSPSetType(ksp,KSPCG); CHKERRQ(ierr);
-    ierr = KSPGetPC(ksp,&pc); CHKERRQ(ierr);
-    ierr = PCSetType(pc,PCICC); CHKERRQ(ierr);
-
-    // setup matrix for Picard iteration, including preallocation
-    ierr = MatCreate(PETSC_COMM_WORLD,&A); CHKERRQ(ierr);
-    ierr = MatSetSizes(A,PETSC_DECIDE,PETSC_DECIDE,mesh.N,mesh.N); CHKERRQ(ierr);
-    ierr = MatSetFromOptions(A); CHKERRQ(ierr);
-    ierr = MatSetOption(A,MAT_SYMMETRIC,PETSC_TRUE); CHKERRQ(ierr);
-    if (noprealloc) {
-        ierr = MatSetUp(A); CHKERRQ(ierr);
-    } else {
-        ierr = Preallocation(A,&user); CHKERRQ(ierr);
-    }
-    ierr = SNESSetJacobian(snes,A,A,FormPicard,&user); CHKERRQ(ierr);
-    ierr = SNESSetFromOptions(snes); CHKERRQ(ierr);
-    PetscLogStagePop();  //STRIP
+    for (step = 0; ; step++) {  // more than one pass only if -un_adapt_steps
+        // mesh is static, so compute geometry and Dirichlet values once
+        PetscLogStagePush(user.setupstage);  //STRIP
+        if (!nogeometry) {
+            ierr = UMCreateGeometry(&mesh,user.quaddegree); CHKERRQ(ierr);
+        }
+        ierr = FillDirichlet(&user); CHKERRQ(ierr);
+        ierr = NeumannSetup(&user); CHKERRQ(ierr);
+        if (color) {
+            ierr = UMCreateElementColoring(&mesh); CHKERRQ(ierr);
+        }
+        if (order == 2) {
+            ierr = P2Setup(&user); CHKERRQ(ierr);
+        }
+        Ndof = (user.p2) ? user.p2->N2 : mesh.Nown;
+        Ndofglobal = (user.p2) ? user.p2->N2 : mesh.Nglobal;
+        PetscLogStagePop();  //STRIP
 
-    // solve
-    PetscLogStagePush(user.solverstage);  //STRIP
-    ierr = SNESSolve(snes,NULL,u);CHKERRQ(ierr);
-    PetscLogStagePop();  //STRIP
+        // configure Vecs and SNES
+        PetscLogStagePush(user.setupstage);  //STRIP
+        ierr = VecCreate(PETSC_COMM_WORLD,&r); CHKERRQ(ierr);
+        ierr = VecSetSizes(r,Ndof,Ndofglobal); CHKERRQ(ierr);
+        ierr = VecSetFromOptions(r); CHKERRQ(ierr);
+        ierr = VecDuplicate(r,&u); CHKERRQ(ierr);
+        if (uinit) {  // transferred from previous mesh
+            ierr = VecCopy(uinit,u); CHKERRQ(ierr);
+            VecDestroy(&uinit);
+        } else {
+            ierr = VecSet(u,0.0); CHKERRQ(ierr);
+        }
+        ierr = UMCreateGlobalToLocal(&mesh,u,&(user.uloc),&(user.ltog)); CHKERRQ(ierr);
+        ierr = SNESCreate(PETSC_COMM_WORLD,&snes); CHKERRQ(ierr);
+        ierr = SNESSetFunction(snes,r,(perfsummary) ? FormFunctionTimed : FormFunction,
+                               &user); CHKERRQ(ierr);
+
+        // reset default KSP and PC; the Newton Jacobian is not symmetric
+        ierr = SNESGetKSP(snes,&ksp); CHKERRQ(ierr);
+        ierr = KSPSetType(ksp,(jac == NEWTON) ? KSPGMRES : KSPCG); CHKERRQ(ierr);
+        ierr = KSPGetPC(ksp,&pc); CHKERRQ(ierr);
+        if (matfree) {
+            ierr = PCSetType(pc,PCJACOBI); CHKERRQ(ierr);
+        } else if (size == 1) {
+            ierr = PCSetType(pc,(jac == NEWTON) ? PCILU : PCICC); CHKERRQ(ierr);
+        } else {
+            ierr = PCSetType(pc,PCBJACOBI); CHKERRQ(ierr);
+        }
+        if (user.mg) {
+            ierr = MGSetupLevels(&user,u); CHKERRQ(ierr);
+            ierr = PCSetType(pc,PCMG); CHKERRQ(ierr);
+            ierr = PCMGSetLevels(pc,mglevels,NULL); CHKERRQ(ierr);
+            ierr = PCMGSetGalerkin(pc,PC_MG_GALERKIN_NONE); CHKERRQ(ierr);
+            for (l = 1; l < mglevels; l++) {
+                ierr = PCMGSetInterpolation(pc,l,user.mg->P[l]); CHKERRQ(ierr);
+            }
+            for (l = 0; l < mglevels-1; l++) {
+                KSP kspl;
+                ierr = PCMGGetSmoother(pc,l,&kspl); CHKERRQ(ierr);
+                ierr = KSPSetOperators(kspl,user.mg->A[l],user.mg->A[l]); CHKERRQ(ierr);
+            }
+        }
+
+        user.usecsrslots = csrslots;
+        user.csrslot = NULL;
+        user.mfa = NULL;
+        user.mfdadu = NULL;
+        user.mfdfdu = NULL;
+        user.mfgradu = NULL;
+        user.mfnewton = PETSC_FALSE;
+        user.vloc = NULL;
+        user.mfdiag = NULL;
+        if (matfree) {
+            // shell matrix; storage is only coefficients at quadrature points
+            const int nq = symmgauss[user.quaddegree-1].n;
+            ierr = PetscMalloc1(nq*mesh.K,&(user.mfa)); CHKERRQ(ierr);
+            if (jac == NEWTON) {
+                ierr = PetscMalloc3(nq*mesh.K,&(user.mfdadu),nq*mesh.K,&(user.mfdfdu),
+                                    2*mesh.K,&(user.mfgradu)); CHKERRQ(ierr);
+            }
+            ierr = VecDuplicate(user.uloc,&(user.vloc)); CHKERRQ(ierr);
+            ierr = VecDuplicate(u,&(user.mfdiag)); CHKERRQ(ierr);
+            ierr = MatCreateShell(PETSC_COMM_WORLD,mesh.Nown,mesh.Nown,
+                                  mesh.Nglobal,mesh.Nglobal,&user,&A); CHKERRQ(ierr);
+            ierr = MatShellSetOperation(A,MATOP_MULT,
+                                        (void(*)(void))MatMult_MatFree); CHKERRQ(ierr);
+            ierr = MatShellSetOperation(A,MATOP_GET_DIAGONAL,
+                                        (void(*)(void))MatGetDiagonal_MatFree); CHKERRQ(ierr);
+        } else {
+            // setup matrix for Picard or Newton iteration, including preallocation
+            // (same nonzero pattern for both)
+            ierr = MatCreate(PETSC_COMM_WORLD,&A); CHKERRQ(ierr);
+            ierr = MatSetSizes(A,Ndof,Ndof,Ndofglobal,Ndofglobal); CHKERRQ(ierr);
+            ierr = MatSetFromOptions(A); CHKERRQ(ierr);
+            if (jac == PICARD) {
+                ierr = MatSetOption(A,MAT_SYMMETRIC,PETSC_TRUE); CHKERRQ(ierr);
+            }
+            if (noprealloc) {
+                ierr = MatSetUp(A); CHKERRQ(ierr);
+            } else if (user.p2) {
+                ierr = PreallocationP2(A,&user); CHKERRQ(ierr);
+            } else {
+                ierr = Preallocation(A,&user); CHKERRQ(ierr);
+            }
+            if (!user.p2) {  // P2 is serial and uses MatSetValues()
+                ierr = MatSetLocalToGlobalMapping(A,mesh.ltog,mesh.ltog); CHKERRQ(ierr);
+            }
+        }
+        user.perf.jacfcn = (jac == NEWTON) ? FormNewton : FormPicard;
+        ierr = SNESSetJacobian(snes,A,A,(perfsummary) ? FormJacobianTimed : user.perf.jacfcn,
+                               &user); CHKERRQ(ierr);
+        ierr = SNESSetFromOptions(snes); CHKERRQ(ierr);
+        PetscLogStagePop();  //STRIP
+
+        // solve
+        PetscLogStagePush(user.solverstage);  //STRIP
+        ierr = SNESSolve(snes,NULL,u);CHKERRQ(ierr);
+        PetscLogStagePop();  //STRIP
 //ENDMAININITIAL
 
-    if (viewsoln) {
-        strcpy(solnname, root);
-        strncat(solnname, ".soln", 5);
-        ierr = UMViewSolutionBinary(&mesh,solnname,u); CHKERRQ(ierr);
-    }
-    if (user.uexact_fcn) {
-        // measure error relative to exact solution
-        ierr = VecDuplicate(r,&uexact); CHKERRQ(ierr);
-        ierr = FillExact(uexact,&user); CHKERRQ(ierr);
-        ierr = VecAXPY(u,-1.0,uexact); CHKERRQ(ierr);    // u <- u + (-1.0) uexact
-        ierr = VecNorm(u,NORM_INFINITY,&err); CHKERRQ(ierr);
-        ierr = PetscPrintf(PETSC_COMM_WORLD,
-                   "case %d result for N=%d nodes with h = %.3e :  |u-u_ex|_inf = %g\n",
-                   user.solncase,mesh.N,h_max,err); CHKERRQ(ierr);
-        VecDestroy(&uexact);
-    } else {
-        ierr = PetscPrintf(PETSC_COMM_WORLD,
-                   "case %d completed for N=%d nodes with h = %.3e (no exact solution)\n",
-                   user.solncase,mesh.N,h_max); CHKERRQ(ierr);
+        if (viewsoln || viewvtk) {
+            IS  isnodes = NULL;
+            Vec unodes = u;
+            if (user.p2) {  // values at nodes only
+                ierr = ISCreateStride(PETSC_COMM_SELF,mesh.N,0,1,&isnodes); CHKERRQ(ierr);
+                ierr = VecGetSubVector(u,isnodes,&unodes); CHKERRQ(ierr);
+            }
+            if (viewsoln) {
+                strcpy(solnname, root);
+                strncat(solnname, ".soln", 5);
+                ierr = UMViewSolutionBinary(&mesh,solnname,unodes); CHKERRQ(ierr);
+            }
+            if (viewvtk) {
+                ierr = UMViewSolutionVTK(&mesh,root,unodes); CHKERRQ(ierr);
+            }
+            if (user.p2) {
+                ierr = VecRestoreSubVector(u,isnodes,&unodes); CHKERRQ(ierr);
+                ISDestroy(&isnodes);
+            }
+        }
+        if (user.uexact_fcn) {
+            // measure error relative to exact solution
+            ierr = VecDuplicate(r,&uexact); CHKERRQ(ierr);
+            ierr = FillExact(uexact,&user); CHKERRQ(ierr);
+            // keep u intact; it is estimated and transferred if -un_adapt_steps
+            ierr = VecAYPX(uexact,-1.0,u); CHKERRQ(ierr);    // uexact <- u + (-1.0) uexact
+            ierr = VecNorm(uexact,NORM_INFINITY,&err); CHKERRQ(ierr);
+            ierr = PetscPrintf(PETSC_COMM_WORLD,
+                       "case %d result for N=%d nodes with h = %.3e :  |u-u_ex|_inf = %g\n",
+                       user.solncase,mesh.Nglobal,h_max,err); CHKERRQ(ierr);
+            VecDestroy(&uexact);
+        } else {
+            ierr = PetscPrintf(PETSC_COMM_WORLD,
+                       "case %d completed for N=%d nodes with h = %.3e (no exact solution)\n",
+                       user.solncase,mesh.Nglobal,h_max); CHKERRQ(ierr);
+        }
+        if (step >= adaptsteps)
+            break;
+
+        // estimate error, mark, refine, and transfer solution to the fine mesh
+        {
+            double    *eta2, eta = 0.0;
+            PetscBool *marked;
+            Mat       T;
+            int       k;
+            ierr = PetscMalloc1(mesh.K,&eta2); CHKERRQ(ierr);
+            ierr = ErrorEstimate(u,&user,eta2); CHKERRQ(ierr);
+            for (k = 0; k < mesh.K; k++)
+                eta += eta2[k];
+            eta = sqrt(eta);
+            ierr = PetscPrintf(PETSC_COMM_WORLD,
+                       "adaptive step %d: N=%d nodes, K=%d elements, error estimate %.3e\n",
+                       step,mesh.Nglobal,mesh.K,eta); CHKERRQ(ierr);
+            if (eta <= adapttol || (adaptmaxnodes > 0 && mesh.N >= adaptmaxnodes)) {
+                PetscFree(eta2);
+                break;
+            }
+            ierr = PetscMalloc1(mesh.K,&marked); CHKERRQ(ierr);
+            ierr = DorflerMark(mesh.K,eta2,adapttheta,marked); CHKERRQ(ierr);
+            ierr = UMRefineMarked(&mesh,marked,&fine,&T); CHKERRQ(ierr);
+            PetscFree(eta2);
+            PetscFree(marked);
+            ierr = MatCreateVecs(T,NULL,&uinit); CHKERRQ(ierr);
+            ierr = MatMult(T,u,uinit); CHKERRQ(ierr);
+            MatDestroy(&T);
+        }
+        VecDestroy(&u);  VecDestroy(&r);
+        VecDestroy(&(user.uloc));  VecScatterDestroy(&(user.ltog));
+        PetscFree(user.gDnode);
+        PetscFree(user.csrslot);
+        ierr = NeumannDestroy(&(user.neu)); CHKERRQ(ierr);
+        MatDestroy(&A);  SNESDestroy(&snes);  UMDestroy(&mesh);
+        mesh = fine;
+        ierr = UMDistribute(&mesh,PETSC_COMM_WORLD); CHKERRQ(ierr);
+        ierr = UMStats(&mesh, &h_max, NULL, NULL, NULL); CHKERRQ(ierr);
+    }
+
+    if (perfsummary) {
+        ierr = PerfSummaryView(&user,bytesread); CHKERRQ(ierr);
     }
 
     // clean-up
     VecDestroy(&u);  VecDestroy(&r);
+    VecDestroy(&(user.uloc));  VecScatterDestroy(&(user.ltog));
+    PetscFree(user.gDnode);
+    PetscFree(user.csrslot);
+    P2Destroy(&(user.p2));
+    MGDestroy(&(user.mg));
+    NeumannDestroy(&(user.neu));
+    if (matfree) {
+        PetscFree(user.mfa);
+        if (jac == NEWTON)
+            PetscFree3(user.mfdadu,user.mfdfdu,user.mfgradu);
+        VecDestroy(&(user.vloc));  VecDestroy(&(user.mfdiag));
+    }
     MatDestroy(&A);  SNESDestroy(&snes);  UMDestroy(&mesh);
     return PetscFinalize();
 }
@@ -23,7 +23,7 @@ static const Quad1D gausslegendre[3]
 //ENDONEDIM
 
 //STARTTRIANGLE
-#define MAXPTS_TRI 4
+#define MAXPTS_TRI 7
 
 typedef struct {
     int    n;               // number of quadrature points for this rule
@@ -32,19 +32,38 @@ typedef struct {
            w[MAXPTS_TRI];   // weights (sum to 0.5)
 } Quad2DTri;
 
-static const Quad2DTri symmgauss[3]
+// symmgauss[d-1] is exact for polynomials of degree d; the degree 4 and 5
+// rules are from Dunavant (1985)
+static const Quad2DTri symmgauss[5]
     = {  {1,
-          {1.0/3.0,    NAN,       NAN,       NAN},
-          {1.0/3.0,    NAN,       NAN,       NAN},
-          {1.0/2.0,    NAN,       NAN,       NAN}},
+          {1.0/3.0,    NAN,       NAN,       NAN,       NAN, NAN, NAN},
+          {1.0/3.0,    NAN,       NAN,       NAN,       NAN, NAN, NAN},
+          {1.0/2.0,    NAN,       NAN,       NAN,       NAN, NAN, NAN}},
          {3,
-          {1.0/6.0,    2.0/3.0,   1.0/6.0,   NAN},
-          {1.0/6.0,    1.0/6.0,   2.0/3.0,   NAN},
-          {1.0/6.0,    1.0/6.0,   1.0/6.0,   NAN}},
+          {1.0/6.0,    2.0/3.0,   1.0/6.0,   NAN,       NAN, NAN, NAN},
+          {1.0/6.0,    1.0/6.0,   2.0/3.0,   NAN,       NAN, NAN, NAN},
+          {1.0/6.0,    1.0/6.0,   1.0/6.0,   NAN,       NAN, NAN, NAN}},
          {4,
-          {1.0/3.0,    1.0/5.0,   3.0/5.0,   1.0/5.0},
-          {1.0/3.0,    1.0/5.0,   1.0/5.0,   3.0/5.0},
-          {-27.0/96.0, 25.0/96.0, 25.0/96.0, 25.0/96.0}}  };
+          {1.0/3.0,    1.0/5.0,   3.0/5.0,   1.0/5.0,   NAN, NAN, NAN},
+          {1.0/3.0,    1.0/5.0,   1.0/5.0,   3.0/5.0,   NAN, NAN, NAN},
+          {-27.0/96.0, 25.0/96.0, 25.0/96.0, 25.0/96.0, NAN, NAN, NAN}},
+         {6,
+          {0.445948490915965, 0.108103018168070, 0.445948490915965,
+           0.091576213509771, 0.816847572980459, 0.091576213509771, NAN},
+          {0.445948490915965, 0.445948490915965, 0.108103018168070,
+           0.091576213509771, 0.091576213509771, 0.816847572980459, NAN},
+          {0.111690794839005, 0.111690794839005, 0.111690794839005,
+           0.054975871827661, 0.054975871827661, 0.054975871827661, NAN}},
+         {7,
+          {1.0/3.0,
+           0.470142064105115, 0.059715871789770, 0.470142064105115,
+           0.101286507323456, 0.797426985353087, 0.101286507323456},
+          {1.0/3.0,
+           0.470142064105115, 0.470142064105115, 0.059715871789770,
+           0.101286507323456, 0.101286507323456, 0.797426985353087},
+          {0.1125,
+           0.066197076394253, 0.066197076394253, 0.066197076394253,
+           0.062969590272414, 0.062969590272414, 0.062969590272414}}  };
 //ENDTRIANGLE
 
 #endif
@@ -1,6 +1,9 @@
 #!/bin/bash
 
-# ./testit.sh PROGRAM OPTS PROCESSES TESTNUM
+# ./testit.sh PROGRAM OPTS PROCESSES TESTNUM [FILTER]
+
+# if FILTER is given (e.g. sort) then output is piped through it before the
+# diff; use this when lines from different processes may interleave
 
 rm -f maketmp tmp difftmp
 
@@ -15,7 +18,11 @@ if [[ ! -f output/$1.test$4 ]]; then
 
 else
 
-    $CMD > tmp
+    if [[ -n "$5" ]]; then
+        $CMD | LC_ALL=C $5 > tmp
+    else
+        $CMD > tmp
+    fi
 
     diff output/$1.test$4 tmp > difftmp
 